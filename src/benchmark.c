@@ -0,0 +1,315 @@
+#include "benchmark.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency_histogram.h"
+#include "list_mm.h"
+
+// Visits of list nodes, per measured operation, that bound how many times
+// operations that traverse the list are measured.
+#define TRAVERSAL_BUDGET 1000000
+
+static const size_t default_sizes[] = {1000, 10000, 100000};
+static const char *const default_backends[] = {"stdio", "pread", "mmap", "memory"};
+
+typedef struct {
+    const BenchmarkConfig *config;
+    FILE *out;
+    const char *backend;
+    size_t size;
+    bool first_result;
+    LatencyHistogram latency;
+    uint64_t random;
+} _Benchmark;
+
+// Fills config with the default parameters of the suite.
+void benchmark_default_config(BenchmarkConfig *config) {
+    config->sizes = default_sizes;
+    config->num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    config->backends = default_backends;
+    config->num_backends = sizeof(default_backends) / sizeof(default_backends[0]);
+    config->ops = 1000;
+    config->cache_capacity = 0;
+    config->file_name = "benchmark.lst";
+    config->seed = 42;
+    config->format = BENCHMARK_CSV;
+}
+
+// Returns a pseudo-random number below bound.
+static size_t next_random(_Benchmark *benchmark, size_t bound) {
+    benchmark->random ^= benchmark->random << 13;
+    benchmark->random ^= benchmark->random >> 7;
+    benchmark->random ^= benchmark->random << 17;
+    return (size_t)(benchmark->random % bound);
+}
+
+// Returns the element stored with the specified value.
+static Element element_of(size_t value) {
+    Element element;
+    element.value = (int)value;
+    snprintf(element.id, sizeof(element.id), "%07zu", value % 10000000);
+    return element;
+}
+
+static bool equal_values(Element *a, Element *b) {
+    return a->value == b->value;
+}
+
+// Returns how many times an operation that traverses the list is measured.
+static size_t traversal_ops(_Benchmark *benchmark) {
+    size_t ops = TRAVERSAL_BUDGET / benchmark->size;
+    if (ops > benchmark->config->ops) {
+        ops = benchmark->config->ops;
+    }
+    return ops == 0 ? 1 : ops;
+}
+
+// Starts measuring an operation on the list.
+static uint64_t begin(_Benchmark *benchmark, ListMM list) {
+    latency_histogram_reset(benchmark->latency);
+    list_reset_stats(list);
+    return latency_now_ns();
+}
+
+// Writes the result of ops repetitions of an operation that started at start.
+static void end(_Benchmark *benchmark, ListMM list, const char *operation, size_t ops, uint64_t start) {
+    uint64_t total_ns = latency_now_ns() - start;
+    FileMemStats stats = list_stats(list);
+    double ns_per_op = (double)total_ns / ops;
+    double ops_per_sec = total_ns == 0 ? 0 : ops * 1e9 / total_ns;
+    FILE *out = benchmark->out;
+    if (benchmark->config->format == BENCHMARK_CSV) {
+        fprintf(out, "%s,%zu,%s,%zu,%.1f,%.0f,%" PRIu64 ",%" PRIu64 ",%.2f,%.2f,%.2f,%.2f,%.1f,%.1f\n",
+                benchmark->backend, benchmark->size, operation, ops, ns_per_op, ops_per_sec,
+                latency_histogram_percentile(benchmark->latency, 50),
+                latency_histogram_percentile(benchmark->latency, 99), (double)stats.cell_reads / ops,
+                (double)stats.cell_writes / ops, (double)stats.storage_reads / ops,
+                (double)stats.storage_writes / ops, (double)stats.bytes_read / ops,
+                (double)stats.bytes_written / ops);
+    } else {
+        fprintf(out,
+                "%s  {\"backend\": \"%s\", \"size\": %zu, \"operation\": \"%s\", \"ops\": %zu, "
+                "\"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", "
+                "\"cell_reads_per_op\": %.2f, \"cell_writes_per_op\": %.2f, "
+                "\"storage_reads_per_op\": %.2f, \"storage_writes_per_op\": %.2f, "
+                "\"bytes_read_per_op\": %.1f, \"bytes_written_per_op\": %.1f}",
+                benchmark->first_result ? "" : ",\n", benchmark->backend, benchmark->size, operation, ops,
+                ns_per_op, ops_per_sec, latency_histogram_percentile(benchmark->latency, 50),
+                latency_histogram_percentile(benchmark->latency, 99), (double)stats.cell_reads / ops,
+                (double)stats.cell_writes / ops, (double)stats.storage_reads / ops,
+                (double)stats.storage_writes / ops, (double)stats.bytes_read / ops,
+                (double)stats.bytes_written / ops);
+    }
+    benchmark->first_result = false;
+}
+
+// Times a single operation into the latency histogram.
+#define TIMED(benchmark, statement)                                                                                   \
+    do {                                                                                                              \
+        uint64_t op_start = latency_now_ns();                                                                         \
+        statement;                                                                                                    \
+        latency_histogram_record((benchmark)->latency, latency_now_ns() - op_start);                                  \
+    } while (0)
+
+// Measures every operation on a list of benchmark->size elements stored
+// through backend. The list is kept at that size between operations.
+static void run_list(_Benchmark *benchmark, ListMM list) {
+    size_t n = benchmark->size;
+    size_t ops = benchmark->config->ops;
+    size_t slow_ops = traversal_ops(benchmark);
+    Element element;
+    uint64_t start;
+
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < n; i++) {
+        element = element_of(i);
+        TIMED(benchmark, list_insert_last(list, &element));
+    }
+    end(benchmark, list, "insert_last", n, start);
+
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < ops; i++) {
+        element = element_of(n + i);
+        TIMED(benchmark, list_insert_first(list, &element));
+    }
+    end(benchmark, list, "insert_first", ops, start);
+
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < ops; i++) {
+        TIMED(benchmark, list_remove_first(list));
+    }
+    end(benchmark, list, "remove_first", ops, start);
+
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < slow_ops; i++) {
+        element = element_of(n + i);
+        TIMED(benchmark, list_insert(list, &element, n / 2));
+    }
+    end(benchmark, list, "insert_middle", slow_ops, start);
+
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < slow_ops; i++) {
+        TIMED(benchmark, list_remove(list, n / 2));
+    }
+    end(benchmark, list, "remove_middle", slow_ops, start);
+
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < slow_ops; i++) {
+        size_t position = next_random(benchmark, n);
+        TIMED(benchmark, list_get(list, position));
+    }
+    end(benchmark, list, "get", slow_ops, start);
+
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < slow_ops; i++) {
+        element = element_of(next_random(benchmark, n));
+        TIMED(benchmark, list_find(list, equal_values, &element));
+    }
+    end(benchmark, list, "find", slow_ops, start);
+
+    size_t removed = slow_ops < n ? slow_ops : n;
+    start = begin(benchmark, list);
+    for (size_t i = 0; i < removed; i++) {
+        TIMED(benchmark, list_remove_last(list));
+    }
+    end(benchmark, list, "remove_last", removed, start);
+    for (size_t i = n - removed; i < n; i++) {
+        element = element_of(i);
+        list_insert_last(list, &element);
+    }
+
+    start = begin(benchmark, list);
+    TIMED(benchmark, list_make_empty(list));
+    end(benchmark, list, "make_empty", 1, start);
+}
+
+// Runs the suite configured by config and writes a result for each backend,
+// size and operation to out. Returns false if a list could not be created.
+bool run_benchmarks(const BenchmarkConfig *config, FILE *out) {
+    _Benchmark benchmark;
+    benchmark.config = config;
+    benchmark.out = out;
+    benchmark.first_result = true;
+    benchmark.latency = latency_histogram_create();
+    benchmark.random = config->seed == 0 ? 1 : config->seed;
+    if (config->format == BENCHMARK_CSV) {
+        fprintf(out, "backend,size,operation,ops,ns_per_op,ops_per_sec,p50_ns,p99_ns,cell_reads_per_op,"
+                     "cell_writes_per_op,storage_reads_per_op,storage_writes_per_op,bytes_read_per_op,"
+                     "bytes_written_per_op\n");
+    } else {
+        fprintf(out, "[\n");
+    }
+    bool created = true;
+    for (size_t b = 0; b < config->num_backends && created; b++) {
+        const StorageBackend *backend = find_storage_backend(config->backends[b]);
+        FileMemOptions options = {.mode = FILE_MEM_PRIVATE, .backend = backend};
+        // The memory backend runs without a file, as a baseline without I/O.
+        const char *file_name = backend == &memory_backend ? NULL : config->file_name;
+        for (size_t s = 0; s < config->num_sizes && created; s++) {
+            benchmark.backend = config->backends[b];
+            benchmark.size = config->sizes[s];
+            if (file_name != NULL) {
+                remove(file_name);
+            }
+            ListMM list = backend == NULL ? NULL : list_create_with_options(file_name, &options);
+            created = list != NULL && benchmark.size > 0;
+            if (created) {
+                if (config->cache_capacity > 0) {
+                    list_enable_cache(list, config->cache_capacity);
+                }
+                run_list(&benchmark, list);
+                list_destroy(list);
+            } else {
+                fprintf(stderr, "Could not create a list of %zu elements with backend %s.\n", benchmark.size,
+                        config->backends[b]);
+            }
+            if (file_name != NULL) {
+                remove(file_name);
+            }
+            fflush(out);
+        }
+    }
+    if (config->format == BENCHMARK_JSON) {
+        fprintf(out, "\n]\n");
+    }
+    latency_histogram_destroy(benchmark.latency);
+    return created;
+}
+
+#define MAX_VALUES 16
+
+// Splits a comma separated list into at most MAX_VALUES values, in place.
+static size_t split(char *list, char **values) {
+    size_t count = 0;
+    for (char *value = strtok(list, ","); value != NULL && count < MAX_VALUES; value = strtok(NULL, ",")) {
+        values[count++] = value;
+    }
+    return count;
+}
+
+static int usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--sizes N,...] [--backends NAME,...] [--ops N] [--cache N] [--file NAME] [--seed N] "
+            "[--json] [--output FILE]\n",
+            program);
+    return 1;
+}
+
+// Runs the suite as configured by the command line arguments, with argv[0]
+// naming the program, and returns the exit status of the program.
+int benchmark_main(int argc, char *argv[]) {
+    BenchmarkConfig config;
+    size_t sizes[MAX_VALUES];
+    char *values[MAX_VALUES];
+    char *backends[MAX_VALUES];
+    const char *output = NULL;
+    benchmark_default_config(&config);
+    for (int i = 1; i < argc; i++) {
+        char *argument = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--json") == 0) {
+            config.format = BENCHMARK_JSON;
+            continue;
+        }
+        if (argument == NULL) {
+            return usage(argv[0]);
+        }
+        i++;
+        if (strcmp(argv[i - 1], "--sizes") == 0) {
+            config.num_sizes = split(argument, values);
+            for (size_t s = 0; s < config.num_sizes; s++) {
+                sizes[s] = (size_t)strtod(values[s], NULL);
+            }
+            config.sizes = sizes;
+        } else if (strcmp(argv[i - 1], "--backends") == 0) {
+            config.num_backends = split(argument, backends);
+            config.backends = (const char *const *)backends;
+        } else if (strcmp(argv[i - 1], "--ops") == 0) {
+            config.ops = (size_t)strtod(argument, NULL);
+        } else if (strcmp(argv[i - 1], "--cache") == 0) {
+            config.cache_capacity = (size_t)strtod(argument, NULL);
+        } else if (strcmp(argv[i - 1], "--file") == 0) {
+            config.file_name = argument;
+        } else if (strcmp(argv[i - 1], "--seed") == 0) {
+            config.seed = strtoull(argument, NULL, 10);
+        } else if (strcmp(argv[i - 1], "--output") == 0) {
+            output = argument;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (config.ops == 0) {
+        return usage(argv[0]);
+    }
+    FILE *out = output == NULL ? stdout : fopen(output, "w");
+    if (out == NULL) {
+        perror(output);
+        return 1;
+    }
+    bool completed = run_benchmarks(&config, out);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return completed ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum { BENCHMARK_CSV, BENCHMARK_JSON } BenchmarkFormat;
+
+// Parameters of the benchmark suite. Every operation is measured on a list of
+// each size stored through each backend.
+typedef struct {
+    const size_t *sizes;
+    size_t num_sizes;
+    // Names of the storage backends, as found by find_storage_backend.
+    const char *const *backends;
+    size_t num_backends;
+    // Number of times each operation is measured. Operations that traverse
+    // the list are measured fewer times on large lists, but at least once.
+    size_t ops;
+    // Capacity of the cache of the list, or 0 for none.
+    size_t cache_capacity;
+    // File of the list, which must not exist.
+    const char *file_name;
+    uint64_t seed;
+    BenchmarkFormat format;
+} BenchmarkConfig;
+
+// Fills config with the default parameters of the suite.
+void benchmark_default_config(BenchmarkConfig *config);
+
+// Runs the suite configured by config and writes a result for each backend,
+// size and operation to out. Returns false if a list could not be created.
+bool run_benchmarks(const BenchmarkConfig *config, FILE *out);
+
+// Runs the suite as configured by the command line arguments, with argv[0]
+// naming the program, and returns the exit status of the program.
+int benchmark_main(int argc, char *argv[]);
+
+#endif
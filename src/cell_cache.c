@@ -0,0 +1,320 @@
+#include "cell_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_ENTRY (-1)
+
+typedef struct {
+    FileCell file_cell;
+    bool dirty;
+    // Set while the cell is written back without the cache being locked, and
+    // whether it was written to in the meantime.
+    bool writing;
+    bool rewritten;
+    uint64_t sequence;
+    uint64_t dirtied_at;
+    int hash_next;
+    int lru_prev;
+    int lru_next;
+    int dirty_prev;
+    int dirty_next;
+} _Entry;
+
+// Entries are kept in a hash table by cell reference and, while clean, in a
+// list ordered from most to least recently used, or, while dirty, in a list
+// ordered from the oldest to the newest dirty entry. Clean entries are evicted
+// first, so that a miss does not have to wait for a dirty cell to be written.
+struct _CellCache {
+    size_t capacity;
+    size_t used;
+    size_t dirty;
+    int cell_size;
+    CellWriter writer;
+    void *context;
+    _Entry *entries;
+    unsigned char *cells;
+    int *buckets;
+    size_t num_buckets;
+    int lru_head;
+    int lru_tail;
+    int dirty_head;
+    int dirty_tail;
+};
+
+// Creates a cache of capacity cells of cell_size bytes. Dirty cells are
+// written back through writer, which receives context.
+CellCache cell_cache_create(size_t capacity, int cell_size, CellWriter writer, void *context) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    CellCache cache = malloc(sizeof(struct _CellCache));
+    cache->capacity = capacity;
+    cache->used = 0;
+    cache->dirty = 0;
+    cache->cell_size = cell_size;
+    cache->writer = writer;
+    cache->context = context;
+    cache->num_buckets = 1;
+    while (cache->num_buckets < 2 * capacity) {
+        cache->num_buckets *= 2;
+    }
+    cache->entries = malloc(capacity * sizeof(_Entry));
+    cache->cells = malloc(capacity * cell_size);
+    cache->buckets = malloc(cache->num_buckets * sizeof(int));
+    if (cache->entries == NULL || cache->cells == NULL || cache->buckets == NULL) {
+        cell_cache_destroy(cache);
+        return NULL;
+    }
+    for (size_t i = 0; i < cache->num_buckets; i++) {
+        cache->buckets[i] = NO_ENTRY;
+    }
+    cache->lru_head = cache->lru_tail = NO_ENTRY;
+    cache->dirty_head = cache->dirty_tail = NO_ENTRY;
+    return cache;
+}
+
+// Destroys the specified cache, discarding its dirty cells.
+void cell_cache_destroy(CellCache cache) {
+    free(cache->entries);
+    free(cache->cells);
+    free(cache->buckets);
+    free(cache);
+}
+
+static size_t bucket_of(CellCache cache, FileCell file_cell) {
+    return ((unsigned)file_cell * 2654435761u) & (cache->num_buckets - 1);
+}
+
+static unsigned char *data_of(CellCache cache, int entry) {
+    return cache->cells + (size_t)entry * cache->cell_size;
+}
+
+static int find(CellCache cache, FileCell file_cell) {
+    int entry = cache->buckets[bucket_of(cache, file_cell)];
+    while (entry != NO_ENTRY && cache->entries[entry].file_cell != file_cell) {
+        entry = cache->entries[entry].hash_next;
+    }
+    return entry;
+}
+
+static void hash_remove(CellCache cache, int entry) {
+    int *link = &cache->buckets[bucket_of(cache, cache->entries[entry].file_cell)];
+    while (*link != entry) {
+        link = &cache->entries[*link].hash_next;
+    }
+    *link = cache->entries[entry].hash_next;
+}
+
+static void lru_unlink(CellCache cache, int entry) {
+    _Entry *e = &cache->entries[entry];
+    if (e->lru_prev != NO_ENTRY) {
+        cache->entries[e->lru_prev].lru_next = e->lru_next;
+    } else {
+        cache->lru_head = e->lru_next;
+    }
+    if (e->lru_next != NO_ENTRY) {
+        cache->entries[e->lru_next].lru_prev = e->lru_prev;
+    } else {
+        cache->lru_tail = e->lru_prev;
+    }
+}
+
+static void lru_push_front(CellCache cache, int entry) {
+    _Entry *e = &cache->entries[entry];
+    e->lru_prev = NO_ENTRY;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head != NO_ENTRY) {
+        cache->entries[cache->lru_head].lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+static void dirty_unlink(CellCache cache, int entry) {
+    _Entry *e = &cache->entries[entry];
+    if (e->dirty_prev != NO_ENTRY) {
+        cache->entries[e->dirty_prev].dirty_next = e->dirty_next;
+    } else {
+        cache->dirty_head = e->dirty_next;
+    }
+    if (e->dirty_next != NO_ENTRY) {
+        cache->entries[e->dirty_next].dirty_prev = e->dirty_prev;
+    } else {
+        cache->dirty_tail = e->dirty_prev;
+    }
+}
+
+static void dirty_push_back(CellCache cache, int entry) {
+    _Entry *e = &cache->entries[entry];
+    e->dirty_next = NO_ENTRY;
+    e->dirty_prev = cache->dirty_tail;
+    if (cache->dirty_tail != NO_ENTRY) {
+        cache->entries[cache->dirty_tail].dirty_next = entry;
+    } else {
+        cache->dirty_head = entry;
+    }
+    cache->dirty_tail = entry;
+}
+
+// Marks the specified dirty entry clean, as most recently used.
+static void mark_clean(CellCache cache, int entry) {
+    dirty_unlink(cache, entry);
+    cache->entries[entry].dirty = false;
+    cache->dirty--;
+    lru_push_front(cache, entry);
+}
+
+// Writes the specified dirty entry back and marks it clean.
+static void write_back(CellCache cache, int entry) {
+    cache->writer(cache->context, cache->entries[entry].file_cell, data_of(cache, entry));
+    mark_clean(cache, entry);
+}
+
+// Returns an entry, in neither list, for the cell whose reference is
+// file_cell, which must not be cached. If the cache is full, the least
+// recently used clean entry is evicted. Only if every entry is dirty is the
+// oldest one that is not being written back written back first.
+static int acquire(CellCache cache, FileCell file_cell) {
+    int entry;
+    if (cache->used < cache->capacity) {
+        entry = (int)cache->used++;
+    } else {
+        if (cache->lru_tail == NO_ENTRY) {
+            entry = cache->dirty_head;
+            while (cache->entries[entry].writing) {
+                entry = cache->entries[entry].dirty_next;
+            }
+            write_back(cache, entry);
+        }
+        entry = cache->lru_tail;
+        hash_remove(cache, entry);
+        lru_unlink(cache, entry);
+    }
+    _Entry *e = &cache->entries[entry];
+    size_t bucket = bucket_of(cache, file_cell);
+    e->file_cell = file_cell;
+    e->dirty = false;
+    e->writing = false;
+    e->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    return entry;
+}
+
+// Copies the cell whose reference is file_cell into cell, and returns true,
+// if the cell is cached, otherwise, returns false.
+bool cell_cache_read(CellCache cache, FileCell file_cell, void *cell) {
+    int entry = find(cache, file_cell);
+    if (entry == NO_ENTRY) {
+        return false;
+    }
+    memcpy(cell, data_of(cache, entry), cache->cell_size);
+    if (!cache->entries[entry].dirty) {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+    }
+    return true;
+}
+
+// Caches a clean copy of the cell whose reference is file_cell, as read from
+// storage. If every cached cell is dirty, making room writes one back.
+void cell_cache_fill(CellCache cache, FileCell file_cell, const void *cell) {
+    if (find(cache, file_cell) == NO_ENTRY) {
+        int entry = acquire(cache, file_cell);
+        memcpy(data_of(cache, entry), cell, cache->cell_size);
+        lru_push_front(cache, entry);
+    }
+}
+
+// Caches the cell whose reference is file_cell as dirty. A cell that becomes
+// dirty records the commit sequence it belongs to and the time it was dirtied.
+void cell_cache_write(CellCache cache, FileCell file_cell, const void *cell, uint64_t sequence, uint64_t now) {
+    int entry = find(cache, file_cell);
+    if (entry == NO_ENTRY) {
+        entry = acquire(cache, file_cell);
+    } else if (!cache->entries[entry].dirty) {
+        lru_unlink(cache, entry);
+    }
+    memcpy(data_of(cache, entry), cell, cache->cell_size);
+    _Entry *e = &cache->entries[entry];
+    e->rewritten = true;
+    if (!e->dirty) {
+        e->dirty = true;
+        e->sequence = sequence;
+        e->dirtied_at = now;
+        dirty_push_back(cache, entry);
+        cache->dirty++;
+    }
+}
+
+// Writes back, oldest first, at most max dirty cells dirtied at or before
+// dirtied_before, and returns how many were written. Pre-condition: no cell is
+// being written back by cell_cache_take_dirty.
+size_t cell_cache_write_back(CellCache cache, size_t max, uint64_t dirtied_before) {
+    size_t written = 0;
+    while (written < max && cache->dirty_head != NO_ENTRY &&
+           cache->entries[cache->dirty_head].dirtied_at <= dirtied_before) {
+        write_back(cache, cache->dirty_head);
+        written++;
+    }
+    return written;
+}
+
+// Copies, oldest first, at most max dirty cells dirtied at or before
+// dirtied_before into cells, and their references into file_cells, so that
+// they can be written back without the cache being locked, and returns how
+// many were copied. At least one cell is always left that a miss can evict. The
+// cells stay dirty, and cannot be evicted, until cell_cache_written is called.
+size_t cell_cache_take_dirty(CellCache cache, size_t max, uint64_t dirtied_before, FileCell *file_cells,
+                             void *cells) {
+    size_t taken = 0;
+    if (max > cache->capacity - 1) {
+        max = cache->capacity - 1;
+    }
+    for (int entry = cache->dirty_head; taken < max && entry != NO_ENTRY &&
+                                        cache->entries[entry].dirtied_at <= dirtied_before;
+         entry = cache->entries[entry].dirty_next) {
+        _Entry *e = &cache->entries[entry];
+        if (!e->writing) {
+            e->writing = true;
+            e->rewritten = false;
+            file_cells[taken] = e->file_cell;
+            memcpy((unsigned char *)cells + taken * cache->cell_size, data_of(cache, entry), cache->cell_size);
+            taken++;
+        }
+    }
+    return taken;
+}
+
+// Ends the write back of the count cells, whose references are in file_cells,
+// that were copied by cell_cache_take_dirty. Those for which written is true
+// are marked clean, unless they were written to in the meantime; the others
+// stay dirty, to be written back again.
+void cell_cache_written(CellCache cache, const FileCell *file_cells, const bool *written, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int entry = find(cache, file_cells[i]);
+        cache->entries[entry].writing = false;
+        if (written[i] && !cache->entries[entry].rewritten) {
+            mark_clean(cache, entry);
+        }
+    }
+}
+
+// Returns the number of dirty cells in the cache.
+size_t cell_cache_dirty(CellCache cache) {
+    return cache->dirty;
+}
+
+// Returns the number of cells the cache can hold.
+size_t cell_cache_capacity(CellCache cache) {
+    return cache->capacity;
+}
+
+// Returns the commit sequence of the oldest dirty cell, or UINT64_MAX if no
+// cell is dirty.
+uint64_t cell_cache_oldest_sequence(CellCache cache) {
+    if (cache->dirty_head == NO_ENTRY) {
+        return UINT64_MAX;
+    }
+    return cache->entries[cache->dirty_head].sequence;
+}
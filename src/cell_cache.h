@@ -0,0 +1,63 @@
+#ifndef CELL_CACHE_H
+#define CELL_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory_manager.h"
+
+typedef struct _CellCache *CellCache;
+
+// Writes the dirty cell whose reference is file_cell back to storage.
+typedef void (*CellWriter)(void *context, FileCell file_cell, const void *cell);
+
+// Creates a cache of capacity cells of cell_size bytes. Dirty cells are
+// written back through writer, which receives context.
+CellCache cell_cache_create(size_t capacity, int cell_size, CellWriter writer, void *context);
+
+// Destroys the specified cache, discarding its dirty cells.
+void cell_cache_destroy(CellCache cache);
+
+// Copies the cell whose reference is file_cell into cell, and returns true,
+// if the cell is cached, otherwise, returns false.
+bool cell_cache_read(CellCache cache, FileCell file_cell, void *cell);
+
+// Caches a clean copy of the cell whose reference is file_cell, as read from
+// storage. If every cached cell is dirty, making room writes one back.
+void cell_cache_fill(CellCache cache, FileCell file_cell, const void *cell);
+
+// Caches the cell whose reference is file_cell as dirty. A cell that becomes
+// dirty records the commit sequence it belongs to and the time it was dirtied.
+void cell_cache_write(CellCache cache, FileCell file_cell, const void *cell, uint64_t sequence, uint64_t now);
+
+// Writes back, oldest first, at most max dirty cells dirtied at or before
+// dirtied_before, and returns how many were written. Pre-condition: no cell is
+// being written back by cell_cache_take_dirty.
+size_t cell_cache_write_back(CellCache cache, size_t max, uint64_t dirtied_before);
+
+// Copies, oldest first, at most max dirty cells dirtied at or before
+// dirtied_before into cells, and their references into file_cells, so that
+// they can be written back without the cache being locked, and returns how
+// many were copied. At least one cell is always left that a miss can evict. The
+// cells stay dirty, and cannot be evicted, until cell_cache_written is called.
+size_t cell_cache_take_dirty(CellCache cache, size_t max, uint64_t dirtied_before, FileCell *file_cells,
+                             void *cells);
+
+// Ends the write back of the count cells, whose references are in file_cells,
+// that were copied by cell_cache_take_dirty. Those for which written is true
+// are marked clean, unless they were written to in the meantime; the others
+// stay dirty, to be written back again.
+void cell_cache_written(CellCache cache, const FileCell *file_cells, const bool *written, size_t count);
+
+// Returns the number of dirty cells in the cache.
+size_t cell_cache_dirty(CellCache cache);
+
+// Returns the number of cells the cache can hold.
+size_t cell_cache_capacity(CellCache cache);
+
+// Returns the commit sequence of the oldest dirty cell, or UINT64_MAX if no
+// cell is dirty.
+uint64_t cell_cache_oldest_sequence(CellCache cache);
+
+#endif
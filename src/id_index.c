@@ -0,0 +1,246 @@
+#include "id_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HEADS_PER_CELL (ID_INDEX_CELL_SIZE / sizeof(FileCell))
+#define MIN_BUCKETS 64
+#define MAX_LOAD 4
+
+typedef struct {
+    char id[ID_SIZE];
+    FileCell cell;
+    FileCell next;
+} _Entry;
+
+typedef struct {
+    FileCell heads[HEADS_PER_CELL];
+} _BucketCell;
+
+// Computes the FNV-1a hash of id.
+static uint32_t hash_id(const char *id) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < ID_SIZE && id[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)id[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the number of chains of the table described at index.
+static size_t num_buckets(const IdIndex *index) {
+    return (size_t)index->bucket_cells * HEADS_PER_CELL;
+}
+
+// Returns the number of bucket cells of a table with a chain per entry, for
+// capacity entries.
+static uint32_t bucket_cells_for(size_t capacity) {
+    size_t buckets = MIN_BUCKETS;
+    while (buckets < capacity) {
+        buckets *= 2;
+    }
+    return (uint32_t)(buckets / HEADS_PER_CELL);
+}
+
+// Allocates bucket_cells consecutive cells at the end of the file, writes the
+// heads of the chains to them and returns a reference to the first.
+static FileCell write_buckets(FileMem file_mem, uint32_t bucket_cells, const FileCell *heads) {
+    FileCell buckets = new_cells(file_mem, (int)bucket_cells);
+    write_cells(file_mem, buckets, (int)bucket_cells, heads);
+    return buckets;
+}
+
+// Reads the heads of all the chains of the table described at index into a
+// new array.
+static FileCell *read_heads(FileMem file_mem, const IdIndex *index) {
+    FileCell *heads = malloc(num_buckets(index) * sizeof(FileCell));
+    read_cells(file_mem, index->buckets, (int)index->bucket_cells, heads);
+    return heads;
+}
+
+// Frees the bucket cells of the table described at index.
+static void free_buckets(FileMem file_mem, const IdIndex *index) {
+    FileCell *cells = malloc(index->bucket_cells * sizeof(FileCell));
+    for (uint32_t i = 0; i < index->bucket_cells; i++) {
+        cells[i] = index->buckets + (FileCell)i;
+    }
+    free_cells(file_mem, cells, (int)index->bucket_cells);
+    free(cells);
+}
+
+// Returns the bucket cell of the chain of id, storing it at bucket, and the
+// position of the head of the chain in it at slot.
+static FileCell find_bucket(FileMem file_mem, const IdIndex *index, const char *id, _BucketCell *bucket,
+                            size_t *slot) {
+    size_t chain = hash_id(id) & (num_buckets(index) - 1);
+    FileCell bucket_cell = index->buckets + (FileCell)(chain / HEADS_PER_CELL);
+    read_cell(file_mem, bucket_cell, bucket);
+    *slot = chain % HEADS_PER_CELL;
+    return bucket_cell;
+}
+
+// Rebuilds the table described at index with a chain per entry, relinking
+// every entry into its new chain with a single write. Each old chain is read
+// whole and relinked from its last entry, so that entries keep their order,
+// and an id mapped several times is still found at its latest cell.
+static void grow(FileMem file_mem, IdIndex *index) {
+    FileCell *old_heads = read_heads(file_mem, index);
+    size_t old_buckets = num_buckets(index);
+    uint32_t bucket_cells = bucket_cells_for(index->entries);
+    size_t buckets = (size_t)bucket_cells * HEADS_PER_CELL;
+    FileCell *heads = calloc(buckets, sizeof(FileCell));
+    _Entry *entries = NULL;
+    FileCell *entry_cells = NULL;
+    size_t capacity = 0;
+    size_t relinked = 0;
+    for (size_t i = 0; i < old_buckets; i++) {
+        size_t count = 0;
+        for (FileCell entry_cell = old_heads[i]; entry_cell != NULL_CELL && relinked < index->entries;
+             entry_cell = entries[count - 1].next) {
+            if (count == capacity) {
+                capacity = capacity == 0 ? 2 * MAX_LOAD : 2 * capacity;
+                entries = realloc(entries, capacity * sizeof(_Entry));
+                entry_cells = realloc(entry_cells, capacity * sizeof(FileCell));
+            }
+            read_cell(file_mem, entry_cell, &entries[count]);
+            entry_cells[count++] = entry_cell;
+            relinked++;
+        }
+        while (count-- > 0) {
+            size_t chain = hash_id(entries[count].id) & (buckets - 1);
+            entries[count].next = heads[chain];
+            heads[chain] = entry_cells[count];
+            write_cell(file_mem, entry_cells[count], &entries[count]);
+        }
+    }
+    free_buckets(file_mem, index);
+    index->buckets = write_buckets(file_mem, bucket_cells, heads);
+    index->bucket_cells = bucket_cells;
+    free(old_heads);
+    free(heads);
+    free(entries);
+    free(entry_cells);
+}
+
+// Creates in the specified file an empty table sized for capacity entries, and
+// describes it at index.
+void id_index_create(FileMem file_mem, IdIndex *index, size_t capacity) {
+    index->bucket_cells = bucket_cells_for(capacity);
+    index->entries = 0;
+    FileCell *heads = calloc(num_buckets(index), sizeof(FileCell));
+    index->buckets = write_buckets(file_mem, index->bucket_cells, heads);
+    free(heads);
+}
+
+// Frees every cell of the table described at index, and clears index.
+void id_index_destroy(FileMem file_mem, IdIndex *index) {
+    _Entry entry;
+    if (index->buckets == NULL_CELL) {
+        return;
+    }
+    FileCell *heads = read_heads(file_mem, index);
+    FileCell *cells = malloc((index->entries + 1) * sizeof(FileCell));
+    size_t count = 0;
+    for (size_t i = 0; i < num_buckets(index); i++) {
+        for (FileCell entry_cell = heads[i]; entry_cell != NULL_CELL && count < index->entries;
+             entry_cell = entry.next) {
+            read_cell(file_mem, entry_cell, &entry);
+            cells[count++] = entry_cell;
+        }
+    }
+    free_cells(file_mem, cells, (int)count);
+    free_buckets(file_mem, index);
+    free(cells);
+    free(heads);
+    memset(index, 0, sizeof(IdIndex));
+}
+
+// Maps id to the cell whose reference is file_cell. The table grows once it
+// holds four entries per chain on average.
+void id_index_add(FileMem file_mem, IdIndex *index, const char *id, FileCell file_cell) {
+    _BucketCell bucket;
+    _Entry entry;
+    size_t slot;
+    if (index->entries >= MAX_LOAD * num_buckets(index)) {
+        grow(file_mem, index);
+    }
+    FileCell bucket_cell = find_bucket(file_mem, index, id, &bucket, &slot);
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.id, id, strnlen(id, ID_SIZE));
+    entry.cell = file_cell;
+    entry.next = bucket.heads[slot];
+    FileCell entry_cell = new_cell(file_mem);
+    write_cell(file_mem, entry_cell, &entry);
+    bucket.heads[slot] = entry_cell;
+    write_cell(file_mem, bucket_cell, &bucket);
+    index->entries++;
+}
+
+// Removes the entry that maps id to the cell whose reference is file_cell,
+// and returns true, if there is one.
+bool id_index_remove(FileMem file_mem, IdIndex *index, const char *id, FileCell file_cell) {
+    _BucketCell bucket;
+    _Entry entry, prev_entry;
+    size_t slot;
+    FileCell bucket_cell = find_bucket(file_mem, index, id, &bucket, &slot);
+    FileCell prev_cell = NULL_CELL;
+    FileCell entry_cell = bucket.heads[slot];
+    while (entry_cell != NULL_CELL) {
+        read_cell(file_mem, entry_cell, &entry);
+        if (entry.cell == file_cell && strncmp(entry.id, id, ID_SIZE) == 0) {
+            if (prev_cell == NULL_CELL) {
+                bucket.heads[slot] = entry.next;
+                write_cell(file_mem, bucket_cell, &bucket);
+            } else {
+                prev_entry.next = entry.next;
+                write_cell(file_mem, prev_cell, &prev_entry);
+            }
+            free_cell(file_mem, entry_cell);
+            index->entries--;
+            return true;
+        }
+        prev_cell = entry_cell;
+        prev_entry = entry;
+        entry_cell = entry.next;
+    }
+    return false;
+}
+
+// Returns the cell that id was mapped to last, or NULL_CELL if there is none.
+FileCell id_index_find(FileMem file_mem, const IdIndex *index, const char *id) {
+    _BucketCell bucket;
+    _Entry entry;
+    size_t slot;
+    find_bucket(file_mem, index, id, &bucket, &slot);
+    for (FileCell entry_cell = bucket.heads[slot]; entry_cell != NULL_CELL; entry_cell = entry.next) {
+        read_cell(file_mem, entry_cell, &entry);
+        if (strncmp(entry.id, id, ID_SIZE) == 0) {
+            return entry.cell;
+        }
+    }
+    return NULL_CELL;
+}
+
+// Calls visit with each cell of the table and ctx, until visit returns false.
+void id_index_for_each_cell(FileMem file_mem, const IdIndex *index, bool (*visit)(FileCell file_cell, void *ctx),
+                            void *ctx) {
+    _Entry entry;
+    if (index->buckets == NULL_CELL) {
+        return;
+    }
+    for (uint32_t i = 0; i < index->bucket_cells; i++) {
+        if (!visit(index->buckets + (FileCell)i, ctx)) {
+            return;
+        }
+    }
+    FileCell *heads = read_heads(file_mem, index);
+    size_t visited = 0;
+    for (size_t i = 0; i < num_buckets(index) && visited <= index->entries; i++) {
+        for (FileCell entry_cell = heads[i]; entry_cell != NULL_CELL; entry_cell = entry.next) {
+            if (visited++ > index->entries || !visit(entry_cell, ctx)) {
+                free(heads);
+                return;
+            }
+            read_cell(file_mem, entry_cell, &entry);
+        }
+    }
+    free(heads);
+}
@@ -0,0 +1,51 @@
+#ifndef ID_INDEX_H
+#define ID_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory_manager.h"
+
+// Number of bytes of an id. Shorter ids end with a null character.
+#define ID_SIZE 8
+
+// Size of the cells of a file that holds an id index.
+#define ID_INDEX_CELL_SIZE 16
+
+// A persistent hash table from ids to cells, stored in the cells of a file
+// whose cells are ID_INDEX_CELL_SIZE bytes long. The heads of its chains are
+// kept, four to a cell, in bucket_cells consecutive cells starting at buckets,
+// and each entry is a cell with an id, the cell it maps to and the next entry.
+// The owner of the file keeps this description in its index, so that changes
+// to the table are committed with it. An empty description, with buckets set
+// to NULL_CELL, stands for no table.
+typedef struct {
+    FileCell buckets;
+    uint32_t bucket_cells;
+    uint64_t entries;
+} IdIndex;
+
+// Creates in the specified file an empty table sized for capacity entries, and
+// describes it at index.
+void id_index_create(FileMem file_mem, IdIndex *index, size_t capacity);
+
+// Frees every cell of the table described at index, and clears index.
+void id_index_destroy(FileMem file_mem, IdIndex *index);
+
+// Maps id to the cell whose reference is file_cell. The table grows once it
+// holds four entries per chain on average.
+void id_index_add(FileMem file_mem, IdIndex *index, const char *id, FileCell file_cell);
+
+// Removes the entry that maps id to the cell whose reference is file_cell,
+// and returns true, if there is one.
+bool id_index_remove(FileMem file_mem, IdIndex *index, const char *id, FileCell file_cell);
+
+// Returns the cell that id was mapped to last, or NULL_CELL if there is none.
+FileCell id_index_find(FileMem file_mem, const IdIndex *index, const char *id);
+
+// Calls visit with each cell of the table and ctx, until visit returns false.
+void id_index_for_each_cell(FileMem file_mem, const IdIndex *index, bool (*visit)(FileCell file_cell, void *ctx),
+                            void *ctx);
+
+#endif
@@ -0,0 +1,143 @@
+#include "latency_histogram.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Values below SUB_BUCKETS have a bucket each. Above that, each power of two
+// is split into SUB_BUCKETS buckets of equal width.
+#define SUB_BUCKET_BITS 5
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_VALUE_BITS 40
+#define NUM_BUCKETS ((MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+#define MAX_VALUE ((UINT64_C(1) << MAX_VALUE_BITS) - 1)
+
+struct _LatencyHistogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[NUM_BUCKETS];
+};
+
+// Creates an empty histogram of latencies in nanoseconds.
+LatencyHistogram latency_histogram_create(void) {
+    return calloc(1, sizeof(struct _LatencyHistogram));
+}
+
+// Destroys the specified histogram.
+void latency_histogram_destroy(LatencyHistogram histogram) {
+    free(histogram);
+}
+
+// Returns the bucket of the specified value.
+static int bucket_of(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + (int)(value >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+}
+
+// Returns the largest value counted in the specified bucket.
+static uint64_t bucket_limit(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return (uint64_t)bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t lowest = (uint64_t)(bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    return lowest + (UINT64_C(1) << shift) - 1;
+}
+
+// Records a latency of value_ns nanoseconds.
+void latency_histogram_record(LatencyHistogram histogram, uint64_t value_ns) {
+    if (value_ns > MAX_VALUE) {
+        value_ns = MAX_VALUE;
+    }
+    __atomic_fetch_add(&histogram->buckets[bucket_of(value_ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value_ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (value_ns > max &&
+           !__atomic_compare_exchange_n(&histogram->max, &max, value_ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Adds the values recorded in source to histogram.
+void latency_histogram_add(LatencyHistogram histogram, LatencyHistogram source) {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        histogram->buckets[i] += source->buckets[i];
+    }
+    histogram->count += source->count;
+    histogram->sum += source->sum;
+    if (source->max > histogram->max) {
+        histogram->max = source->max;
+    }
+}
+
+// Discards every recorded value.
+void latency_histogram_reset(LatencyHistogram histogram) {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        histogram->buckets[i] = 0;
+    }
+    histogram->count = 0;
+    histogram->sum = 0;
+    histogram->max = 0;
+}
+
+// Returns the number of recorded values.
+uint64_t latency_histogram_count(LatencyHistogram histogram) {
+    return __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+}
+
+// Returns the mean of the recorded values, or 0 if there are none.
+double latency_histogram_mean(LatencyHistogram histogram) {
+    uint64_t count = latency_histogram_count(histogram);
+    return count == 0 ? 0 : (double)__atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) / count;
+}
+
+// Returns the largest recorded value.
+uint64_t latency_histogram_max(LatencyHistogram histogram) {
+    return __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+// Returns the value below which percentile percent of the recorded values
+// fall. The value reported for a bucket is the largest one it counts.
+uint64_t latency_histogram_percentile(LatencyHistogram histogram, double percentile) {
+    uint64_t count = latency_histogram_count(histogram);
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100 * count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t max = latency_histogram_max(histogram);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            uint64_t limit = bucket_limit(i);
+            return limit < max ? limit : max;
+        }
+    }
+    return max;
+}
+
+// Prints a line named name with the count, mean, p50, p90, p99, p999 and
+// maximum of the recorded values to out.
+void latency_histogram_print(LatencyHistogram histogram, FILE *out, const char *name) {
+    fprintf(out,
+            "%-16s count=%" PRIu64 " mean=%.0fns p50=%" PRIu64 "ns p90=%" PRIu64 "ns p99=%" PRIu64 "ns p999=%" PRIu64
+            "ns max=%" PRIu64 "ns\n",
+            name, latency_histogram_count(histogram), latency_histogram_mean(histogram),
+            latency_histogram_percentile(histogram, 50), latency_histogram_percentile(histogram, 90),
+            latency_histogram_percentile(histogram, 99), latency_histogram_percentile(histogram, 99.9),
+            latency_histogram_max(histogram));
+}
+
+// Returns the value of a monotonic clock in nanoseconds.
+uint64_t latency_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
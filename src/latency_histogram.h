@@ -0,0 +1,47 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct _LatencyHistogram *LatencyHistogram;
+
+// Creates an empty histogram of latencies in nanoseconds. Values are counted
+// in buckets whose width is a power of two over 32 sub-buckets, so reported
+// values are within about 3% of the recorded ones.
+LatencyHistogram latency_histogram_create(void);
+
+// Destroys the specified histogram.
+void latency_histogram_destroy(LatencyHistogram histogram);
+
+// Records a latency of value_ns nanoseconds. Safe to call from several
+// threads at once.
+void latency_histogram_record(LatencyHistogram histogram, uint64_t value_ns);
+
+// Adds the values recorded in source to histogram.
+void latency_histogram_add(LatencyHistogram histogram, LatencyHistogram source);
+
+// Discards every recorded value.
+void latency_histogram_reset(LatencyHistogram histogram);
+
+// Returns the number of recorded values.
+uint64_t latency_histogram_count(LatencyHistogram histogram);
+
+// Returns the mean of the recorded values, or 0 if there are none.
+double latency_histogram_mean(LatencyHistogram histogram);
+
+// Returns the largest recorded value.
+uint64_t latency_histogram_max(LatencyHistogram histogram);
+
+// Returns the value below which percentile percent of the recorded values
+// fall, e.g. 99.9 for the p999. Returns 0 if there are no values.
+uint64_t latency_histogram_percentile(LatencyHistogram histogram, double percentile);
+
+// Prints a line named name with the count, mean, p50, p90, p99, p999 and
+// maximum of the recorded values to out.
+void latency_histogram_print(LatencyHistogram histogram, FILE *out, const char *name);
+
+// Returns the value of a monotonic clock in nanoseconds.
+uint64_t latency_now_ns(void);
+
+#endif
@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
+#include "latency_histogram.h"
 #include "memory_manager.h"
 
 struct Data {
@@ -14,18 +16,114 @@ typedef struct Data Element;
 
 typedef struct ListMM_* ListMM;
 
+typedef struct ListVersion_* ListVersion;
+
+typedef struct ListCursor_* ListCursor;
+
+// Size and layout of a list file.
+typedef struct {
+    size_t size;
+    // Cells in the file, and how many of them are free.
+    int num_cells;
+    int free_cells;
+    // Cells freed by a shared writer that readers may still reach.
+    int retired_cells;
+    // Links from an element to the next one that do not lead to the
+    // next cell in the file, so that reading the list seeks.
+    size_t out_of_order;
+    // Whether the list is known to be stored in order in the first
+    // cells of the file, which lets it be exported as a range of cells.
+    bool sequential;
+    // Cells holding the id index of the list, if it has one.
+    size_t id_index_cells;
+    long file_size;
+} ListMMInfo;
+
+// Operations whose latency is recorded by list_enable_latency.
+typedef enum {
+    LIST_OP_IS_EMPTY,
+    LIST_OP_SIZE,
+    LIST_OP_INSERT_FIRST,
+    LIST_OP_INSERT_LAST,
+    LIST_OP_INSERT,
+    LIST_OP_FIND,
+    LIST_OP_GET_FIRST,
+    LIST_OP_GET_LAST,
+    LIST_OP_GET,
+    LIST_OP_REMOVE_FIRST,
+    LIST_OP_REMOVE_LAST,
+    LIST_OP_REMOVE,
+    LIST_OP_MAKE_EMPTY,
+    LIST_OP_GET_RANGE,
+    LIST_OP_GET_MANY,
+    LIST_OP_SET,
+    LIST_OP_UPSERT,
+    LIST_OP_REMOVE_RANGE,
+    LIST_OP_REMOVE_POSITIONS,
+    LIST_OP_REMOVE_IF,
+    LIST_OP_APPEND,
+    LIST_OP_FOR_EACH,
+    LIST_OP_MAP,
+    LIST_OP_FOLD,
+    LIST_OP_FIND_BY_ID,
+    LIST_OP_CURSOR,
+    LIST_OP_CURSOR_SET,
+    LIST_OP_CURSOR_NEXT,
+    LIST_OP_CURSOR_CLOSE,
+    LIST_OP_COUNT
+} ListOperation;
+
 // Creates a new list.
 ListMM list_create(const char* file_name);
 
+// Creates a new list that only exists in memory. It is lost when
+// destroyed or closed, unless it is saved with list_dump.
+ListMM list_create_in_memory(void);
+
+// Saves the list to a new file, which can then be opened with
+// list_open. Returns false if the file already exists or could not
+// be written.
+bool list_dump(ListMM list, const char* file_name);
+
+// Copies the list, with its pending changes, to a new file whose name
+// is file_name, and opens the copy as a separate list. On Linux file
+// systems with reflinks, the copy shares the blocks of the list file
+// until either is changed, so it is nearly instant. Returns NULL if the file
+// already exists or could not be written.
+ListMM list_clone(ListMM list, const char* file_name);
+
 // Destroys a list.
 void list_destroy(ListMM list);
 
-// Opens a list.
+// Opens a list. Returns NULL if the file does not hold a list.
 ListMM list_open(const char* file_name);
 
 // Closes a list;
 void list_close(ListMM list);
 
+// Creates a new list whose file is configured by options.
+ListMM list_create_with_options(const char* file_name, const FileMemOptions* options);
+
+// Opens a list whose file is configured by options, or returns NULL
+// if it could not be opened or does not hold a list. A list opened
+// as a FILE_MEM_SHARED_READER is a read-only snapshot that can be
+// refreshed with list_refresh. A list opened or created as a
+// FILE_MEM_SHARED_WRITER is versioned, and has no id index, so
+// that its changes copy the nodes they modify instead of rewriting
+// them; with the cells of a snapshot never reused while it is held,
+// every snapshot stays consistent.
+ListMM list_open_with_options(const char* file_name, const FileMemOptions* options);
+
+// Loads the latest changes committed by the writer into a list
+// opened as a shared reader. Returns true if the list changed.
+bool list_refresh(ListMM list);
+
+// Makes the list safe to use from several threads at once:
+// any number of threads may read the list in parallel, while
+// operations that change it run exclusively.
+// Must be called before the list is shared.
+void list_set_thread_safe(ListMM list, bool thread_safe);
+
 // Returns true iff the list contains no elements.
 bool list_is_empty(ListMM list);
 
@@ -42,6 +140,68 @@ Element list_get_last(ListMM list);
 // Range of valid positions: 0, ..., size()-1.
 Element list_get(ListMM list, size_t position);
 
+// Copies to out up to count elements of the list, in order, starting
+// with the element at position start, and returns how many were
+// copied, which is fewer than count if the list ends before. The list
+// is walked once, reading consecutive cells together.
+size_t list_get_range(ListMM list, size_t start, size_t count, Element* out);
+
+// Copies to out[i] the element at positions[i], for each i < n, and
+// returns how many of the positions were valid; out[i] is left as it
+// was for the others. Positions may be in any order and repeat. The
+// list is walked once, up to the largest position.
+size_t list_get_many(ListMM list, const size_t* positions, size_t n, Element* out);
+
+// Replaces the element at the specified position in the list with
+// element, rewriting only the cell that stores it: a list stored in
+// order, or its last position, needs no reads. In a versioned list,
+// the cells before it are copied as by list_insert.
+// Range of valid positions: 0, ..., size()-1.
+void list_set(ListMM list, size_t position, const Element* element);
+
+// Replaces the first element of the list for which key_equal, called
+// with it and element, returns true with element, or, if there is
+// none, inserts element at the last position. Returns true if an
+// element was replaced. The list is walked once in either case; a
+// versioned list holds the nodes walked in memory, to copy them if
+// one matches.
+bool list_upsert(ListMM list, bool (*key_equal)(const Element* a, const Element* b), const Element* element);
+
+// Opens a cursor at the first position of the list, to read and
+// replace its elements in a single walk. The cursor holds the lock of
+// the list, so no other operation on the list may be called until it
+// is closed.
+ListCursor list_cursor(ListMM list);
+
+// Opens a cursor at the first position of the list that can only read
+// its elements. Like the other read operations, it shares the lock of
+// a thread-safe list, so other readers are not blocked while it is
+// open.
+ListCursor list_read_cursor(ListMM list);
+
+// Returns true if the cursor is at an element of the list, or false
+// if it is past the last one.
+bool list_cursor_valid(ListCursor cursor);
+
+// Returns the element at the position of the cursor.
+Element list_cursor_get(ListCursor cursor);
+
+// Replaces the element at the position of the cursor with element.
+// Unless the list is versioned, this is a single write to its cell.
+// In a versioned list, the nodes since the last one replaced are
+// copied, so a pass copies the list up to the last replaced element
+// once, and the changes are committed when the cursor is closed.
+// Returns false, changing nothing, if the cursor was opened with
+// list_read_cursor or is past the last element.
+bool list_cursor_set(ListCursor cursor, const Element* element);
+
+// Moves the cursor to the next position of the list.
+void list_cursor_next(ListCursor cursor);
+
+// Closes the cursor, committing the changes made through it to a
+// versioned list, and releasing the lock of the list.
+void list_cursor_close(ListCursor cursor);
+
 // Returns the position in the list of the
 // first occurrence of the specified element,
 // or -1 if the specified element does not
@@ -70,7 +230,170 @@ Element list_remove_last(ListMM list);
 // Range of valid positions: 0, ..., size()-1.
 Element list_remove(ListMM list, size_t position);
 
+// Removes up to count elements of the list, starting with the element
+// at position start, and returns how many were removed. The block is
+// unlinked with a single change to the node before it, and its cells
+// are freed together.
+size_t list_remove_range(ListMM list, size_t start, size_t count);
+
+// Removes the elements at the n specified positions, which refer to
+// the list before the removal and may be in any order and repeat, and
+// returns how many were removed. Positions past the end are ignored.
+// The list is walked once, up to the largest position.
+size_t list_remove_positions(ListMM list, const size_t* positions, size_t n);
+
+// Removes the elements of the list for which pred, called with each
+// element, in order, and ctx, returns true, and returns how many were
+// removed. The list is walked once, each node before a removed one is
+// written at most once, and the removed cells are freed together.
+size_t list_remove_if(ListMM list, bool (*pred)(const Element* element, void* ctx), void* ctx);
+
 // Removes all elements from the list.
 void list_make_empty(ListMM list);
 
-#endif
\ No newline at end of file
+// Inserts count elements, in order, at the end of the list, with a
+// single commit.
+void list_append(ListMM list, const Element* elements, size_t count);
+
+// Calls visit with each element of the list, in order, and ctx, until
+// visit returns false. The list is walked once, reading consecutive
+// cells together.
+void list_for_each(ListMM list, bool (*visit)(const Element* element, void* ctx), void* ctx);
+
+// Calls transform with each element of the list, in order, and ctx,
+// letting it change the element in place; transform returns true if
+// it did. Only changed elements are written, those in consecutive
+// cells together.
+void list_map(ListMM list, bool (*transform)(Element* element, void* ctx), void* ctx);
+
+// Returns the result of combining initial with each element of the
+// list, in order: combine receives the result so far, the element and
+// ctx, and returns the next result.
+long long list_fold(ListMM list, long long initial, long long (*combine)(long long acc, const Element* element, void* ctx),
+                    void* ctx);
+
+// Returns the size and layout of the list file.
+ListMMInfo list_info(ListMM list);
+
+// Checks that the elements of the list and the free cells of its file
+// account for every cell exactly once, describing each problem found
+// on report unless it is NULL. Returns the number of problems. Nodes
+// retired by a versioned list count as lost until they are freed.
+size_t list_verify(ListMM list, FILE* report);
+
+// Writes the elements of the list, in order, to the file descriptor
+// fd as a snapshot: a header with their number followed by the
+// elements, densely packed in the byte order of this machine. The
+// descriptor may be a file, a pipe or a socket. A list stored in
+// order in the first cells of its file, as after list_compact or
+// list_import_snapshot, is written as those cells instead, which the
+// kernel copies straight from the list file. Returns false if the
+// snapshot could not be completely written.
+bool list_export_snapshot(ListMM list, int fd);
+
+// Creates a list in the file whose name is file_name from the
+// snapshot read from the file descriptor fd, in either form written
+// by list_export_snapshot. The elements are stored in order, in
+// consecutive cells. Returns NULL if the file already
+// exists or the snapshot is not complete, in which case no file is
+// left behind.
+ListMM list_import_snapshot(const char* file_name, int fd);
+
+// Builds an index of the elements of the list by id, kept in cells of
+// the list file and maintained by every change to the list, so that
+// list_find_by_id reads a few cells instead of the whole list. Returns
+// false if the list is versioned, or its file was created before lists
+// had id indexes. Making the list versioned removes its id index.
+bool list_enable_id_index(ListMM list);
+
+// Removes the id index of the list, if it has one, freeing its cells.
+void list_disable_id_index(ListMM list);
+
+// Returns true if the list has an id index.
+bool list_has_id_index(ListMM list);
+
+// Copies to element an element of the list whose id is the string
+// pointed to by id, and returns true, if there is one. Returns
+// false for ids longer than an element's id. If several elements
+// have the id, which one is found is unspecified.
+bool list_find_by_id(ListMM list, const char* id, Element* element);
+
+// Rewrites the list in the file whose name is file_name so that its
+// elements are stored in order, in consecutive cells, with no free
+// cells. The file must not be in use, and a file with ".compact"
+// appended to its name is used as scratch. Returns false on failure,
+// in which case the file is left as it was.
+bool list_compact(const char* file_name);
+
+// Enables a write-back cache of capacity nodes for the list.
+// Returns false if the list already has a cache.
+bool list_enable_cache(ListMM list, size_t capacity);
+
+// Starts a background thread that writes cached nodes back to the
+// list file, so that insertions do not stall on large flushes.
+// Requires a cache.
+bool list_start_flusher(ListMM list, const FlusherConfig* config);
+
+// Writes every cached change of the list to the list file.
+void list_flush(ListMM list);
+
+// Returns the I/O counters of the list file.
+FileMemStats list_stats(ListMM list);
+
+// Resets the I/O counters of the list file.
+void list_reset_stats(ListMM list);
+
+// Starts recording every access to the list file in a trace file,
+// which can be replayed by the replay tool. Returns false if the
+// list is already traced or the trace could not be created.
+bool list_start_trace(ListMM list, const char* trace_file_name);
+
+// Stops recording the accesses to the list file.
+bool list_stop_trace(ListMM list);
+
+// Records the latency of every ListOperation done on the list,
+// including the time spent waiting for the list lock, which a cursor
+// waits for when it is opened. list_cursor_get, list_cursor_valid and
+// the functions that manage the list file are not timed. Must be
+// called before the list is shared. Returns false if latencies are
+// already recorded.
+bool list_enable_latency(ListMM list);
+
+// Returns the latencies recorded for the specified operation, or
+// NULL if they are not recorded.
+LatencyHistogram list_latency(ListMM list, ListOperation operation);
+
+// Returns the name of the specified operation.
+const char* list_operation_name(ListOperation operation);
+
+// Prints the latency percentiles of every operation done on the
+// list to out.
+void list_print_latency(ListMM list, FILE* out);
+
+// Makes changes to the list copy the nodes they modify instead of
+// overwriting them, so that pinned versions stay intact.
+// Must be called while no version of the list is pinned. A list
+// opened as a FILE_MEM_SHARED_WRITER is versioned, and stays so.
+void list_set_versioned(ListMM list, bool versioned);
+
+// Pins the latest version of a versioned list, or returns NULL
+// if the list is not versioned. A pinned version can be read
+// without taking the list lock while the list keeps changing.
+ListVersion list_pin(ListMM list);
+
+// Releases a pinned version. The nodes only it could reach are
+// freed by the next change to the list.
+void list_unpin(ListVersion version);
+
+// Returns the number of elements in the pinned version.
+size_t list_version_size(ListVersion version);
+
+// Returns the element at the specified position in the pinned version.
+// Range of valid positions: 0, ..., list_version_size()-1.
+Element list_version_get(ListVersion version, size_t position);
+
+// Returns the position in the pinned version of the first occurrence
+// of the specified element, or -1 if it does not occur.
+int list_version_find(ListVersion version, bool (*equal)(Element*, Element*), Element* element);
+
+#endif
@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "benchmark.h"
+#include "list_mm.h"
+
+// Number of elements read and appended at a time by import.
+#define IMPORT_BATCH 4096
+
+static int usage(void) {
+    fprintf(stderr,
+            "Usage: main create FILE\n"
+            "       main import FILE INPUT [--binary | --snapshot]\n"
+            "       main export FILE OUTPUT [--binary | --snapshot]\n"
+            "       main stats FILE\n"
+            "       main compact FILE\n"
+            "       main verify FILE\n"
+            "       main index FILE\n"
+            "       main find FILE ID\n"
+            "       main bench [--sizes N,...] [--backends NAME,...] [--ops N] [--cache N] [--json] ...\n"
+            "INPUT and OUTPUT may be - for the standard input and output. Text files have a line\n"
+            "value,id per element; binary files hold the elements as stored in memory. Snapshots\n"
+            "are imported into a new, compact FILE. index builds an id index in FILE, which find\n"
+            "then uses to look an element up by id.\n");
+    return 1;
+}
+
+// Opens a stream named name, or the standard one if name is "-".
+static FILE *open_stream(const char *name, const char *mode) {
+    if (strcmp(name, "-") == 0) {
+        return mode[0] == 'r' ? stdin : stdout;
+    }
+    FILE *stream = fopen(name, mode);
+    if (stream == NULL) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    }
+    return stream;
+}
+
+static void close_stream(FILE *stream) {
+    if (stream != stdin && stream != stdout) {
+        fclose(stream);
+    }
+}
+
+// Parses a line value,id into element. Returns false if it is malformed.
+static bool parse_element(char *line, Element *element) {
+    char *comma = strchr(line, ',');
+    char *end;
+    if (comma == NULL) {
+        return false;
+    }
+    *comma = '\0';
+    long value = strtol(line, &end, 10);
+    if (end == line || *end != '\0') {
+        return false;
+    }
+    char *id = comma + 1;
+    id[strcspn(id, "\r\n")] = '\0';
+    if (strlen(id) > sizeof(element->id)) {
+        return false;
+    }
+    element->value = (int)value;
+    memset(element->id, 0, sizeof(element->id));
+    memcpy(element->id, id, strlen(id));
+    return true;
+}
+
+// Appends the elements read from input to the list, in batches.
+static int import(ListMM list, FILE *input, bool binary) {
+    static Element elements[IMPORT_BATCH];
+    char line[256];
+    size_t count = 0, total = 0, line_number = 0;
+    for (;;) {
+        if (binary) {
+            count = fread(elements, sizeof(Element), IMPORT_BATCH, input);
+        } else {
+            for (count = 0; count < IMPORT_BATCH && fgets(line, sizeof(line), input) != NULL;) {
+                line_number++;
+                if (line[strspn(line, " \r\n")] == '\0') {
+                    continue;
+                }
+                if (!parse_element(line, &elements[count])) {
+                    fprintf(stderr, "Line %zu is not value,id; %zu elements imported.\n", line_number, total);
+                    return 1;
+                }
+                count++;
+            }
+        }
+        if (count == 0) {
+            break;
+        }
+        list_append(list, elements, count);
+        total += count;
+    }
+    printf("%zu elements imported.\n", total);
+    return 0;
+}
+
+typedef struct {
+    FILE *output;
+    bool binary;
+    bool failed;
+} ExportContext;
+
+static bool export_element(const Element *element, void *ctx) {
+    ExportContext *export = (ExportContext *)ctx;
+    if (export->binary) {
+        export->failed = fwrite(element, sizeof(Element), 1, export->output) != 1;
+    } else {
+        export->failed = fprintf(export->output, "%d,%.*s\n", element->value,
+                                 (int)strnlen(element->id, sizeof(element->id)), element->id) < 0;
+    }
+    return !export->failed;
+}
+
+static int stats(ListMM list) {
+    ListMMInfo info = list_info(list);
+    int used = info.num_cells - info.free_cells - info.retired_cells;
+    printf("elements:      %zu\n", info.size);
+    printf("cells:         %d\n", info.num_cells);
+    printf("free cells:    %d (%.1f%%)\n", info.free_cells,
+           info.num_cells == 0 ? 0.0 : 100.0 * info.free_cells / info.num_cells);
+    if (info.retired_cells > 0) {
+        printf("retired cells: %d\n", info.retired_cells);
+    }
+    printf("out of order:  %zu (%.1f%% of links)\n", info.out_of_order,
+           info.size < 2 ? 0.0 : 100.0 * info.out_of_order / (info.size - 1));
+    printf("sequential:    %s\n", info.sequential ? "yes" : "no");
+    if (info.id_index_cells > 0) {
+        printf("id index:      %zu cells\n", info.id_index_cells);
+    }
+    printf("file size:     %ld bytes\n", info.file_size);
+    if ((size_t)used != info.size + info.id_index_cells) {
+        printf("lost cells:    %ld\n", (long)used - (long)info.size - (long)info.id_index_cells);
+    }
+    return 0;
+}
+
+// Imports or exports, as command says, the list in the file whose name is
+// file_name from or to a snapshot in the file whose name is stream_name.
+static int transfer_snapshot(const char *command, const char *file_name, const char *stream_name) {
+    bool import = strcmp(command, "import") == 0;
+    int fd = import ? STDIN_FILENO : STDOUT_FILENO;
+    if (strcmp(stream_name, "-") != 0) {
+        fd = import ? open(stream_name, O_RDONLY) : open(stream_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", stream_name, strerror(errno));
+            return 1;
+        }
+    }
+    bool transferred;
+    if (import) {
+        ListMM list = list_import_snapshot(file_name, fd);
+        transferred = list != NULL;
+        if (transferred) {
+            fprintf(stderr, "%zu elements imported.\n", list_size(list));
+            list_close(list);
+        } else {
+            fprintf(stderr, "Could not import the snapshot into %s; it may be incomplete, or the file may exist.\n",
+                    file_name);
+        }
+    } else {
+        ListMM list = list_open(file_name);
+        transferred = list != NULL && list_export_snapshot(list, fd);
+        if (list != NULL) {
+            list_close(list);
+        }
+        if (!transferred) {
+            fprintf(stderr, "Could not export %s.\n", file_name);
+        }
+    }
+    if (fd != STDIN_FILENO && fd != STDOUT_FILENO) {
+        transferred = close(fd) == 0 && transferred;
+    }
+    return transferred ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        return usage();
+    }
+    const char *command = argv[1];
+    if (strcmp(command, "bench") == 0) {
+        return benchmark_main(argc - 1, argv + 1);
+    }
+    if (argc < 3) {
+        return usage();
+    }
+    const char *file_name = argv[2];
+    bool binary = argc > 4 && strcmp(argv[4], "--binary") == 0;
+    bool snapshot = argc > 4 && strcmp(argv[4], "--snapshot") == 0;
+
+    if (strcmp(command, "create") == 0) {
+        ListMM list = list_create(file_name);
+        if (list == NULL) {
+            fprintf(stderr, "Could not create %s; it may already exist.\n", file_name);
+            return 1;
+        }
+        list_close(list);
+        return 0;
+    }
+    if (strcmp(command, "compact") == 0) {
+        if (!list_compact(file_name)) {
+            fprintf(stderr, "Could not compact %s.\n", file_name);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (snapshot && argc >= 4 && (strcmp(command, "import") == 0 || strcmp(command, "export") == 0)) {
+        return transfer_snapshot(command, file_name, argv[3]);
+    }
+
+    int status = 0;
+    ListMM list;
+    if (strcmp(command, "import") == 0) {
+        if (argc < 4) {
+            return usage();
+        }
+        list = list_open(file_name);
+        if (list == NULL) {
+            list = list_create(file_name);
+        }
+        FILE *input = list == NULL ? NULL : open_stream(argv[3], binary ? "rb" : "r");
+        if (input != NULL) {
+            status = import(list, input, binary);
+            close_stream(input);
+        } else {
+            status = 1;
+        }
+    } else {
+        list = list_open(file_name);
+        if (list == NULL) {
+            fprintf(stderr, "Could not open %s as a list.\n", file_name);
+            return 1;
+        }
+        if (strcmp(command, "export") == 0 && argc >= 4) {
+            ExportContext export = {open_stream(argv[3], binary ? "wb" : "w"), binary, false};
+            status = 1;
+            if (export.output != NULL) {
+                list_for_each(list, export_element, &export);
+                status = export.failed || fflush(export.output) != 0 ? 1 : 0;
+                close_stream(export.output);
+            }
+        } else if (strcmp(command, "stats") == 0) {
+            status = stats(list);
+        } else if (strcmp(command, "verify") == 0) {
+            size_t problems = list_verify(list, stdout);
+            printf(problems == 0 ? "%s is consistent.\n" : "%s has problems.\n", file_name);
+            status = problems == 0 ? 0 : 2;
+        } else if (strcmp(command, "index") == 0) {
+            status = list_enable_id_index(list) ? 0 : 1;
+            if (status != 0) {
+                fprintf(stderr, "%s is too old to hold an id index; compact it first.\n", file_name);
+            }
+        } else if (strcmp(command, "find") == 0 && argc >= 4) {
+            Element element;
+            if (strlen(argv[3]) > sizeof(element.id)) {
+                fprintf(stderr, "Ids are at most %zu characters long.\n", sizeof(element.id));
+                status = 1;
+            } else if (list_find_by_id(list, argv[3], &element)) {
+                status = 0;
+                printf("%d,%.*s\n", element.value, (int)strnlen(element.id, sizeof(element.id)), element.id);
+            } else {
+                fprintf(stderr, "No element of %s has id %s.\n", file_name, argv[3]);
+                status = 1;
+            }
+        } else {
+            status = usage();
+        }
+    }
+    if (list == NULL) {
+        fprintf(stderr, "Could not open or create %s.\n", file_name);
+        return 1;
+    }
+    list_close(list);
+    return status;
+}
@@ -1,5 +1,23 @@
+#define _GNU_SOURCE
 #include "memory_manager.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "cell_cache.h"
+#include "trace.h"
 
 typedef struct {
     int index_size;
@@ -8,101 +26,806 @@ typedef struct {
     FileCell free_cells;
 } _ControlInfo;
 
+// Header of a superblock slot. It is followed by the index, and the last
+// CHECKSUM_SIZE bytes of the slot hold a checksum of everything before them.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sequence;
+    _ControlInfo control_info;
+} _SuperblockHeader;
+
+// Trailer of a superblock slot, just before its checksum. It refers to a chain
+// of cells listing the cells that were still retired when a shared writer
+// closed the file, which no reader of the commit with the specified sequence
+// number, or of a later one, can reach. Files written before the trailer was
+// introduced have zeros there, as the unused bytes of a slot.
+typedef struct {
+    uint64_t retired_sequence;
+    FileCell retired_cells;
+    uint32_t unused;
+} _SuperblockTrailer;
+
+// A cell freed by a shared writer, with the commit that unlinks it.
+typedef struct {
+    FileCell cell;
+    uint64_t sequence;
+} _RetiredCell;
+
+// The latest commit is kept as a superblock image until it can be written:
+// with a cache, that is only once every cell dirtied before the commit has
+// been written back, so the file never holds a superblock that refers to
+// cells whose contents are still in memory.
 struct _FileMem {
     _ControlInfo control_info;
-    FILE *file;
+    void *index;
+    uint64_t sequence;
+    bool header_dirty;
+    bool header_pending;
+    unsigned char pending[SUPERBLOCK_SIZE];
+    const StorageBackend *backend;
+    void *storage;
+    FileMemMode mode;
+    CellCache cache;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // Serializes the calls to the backend, as the flusher writes cells back
+    // without holding lock, and is set while it does.
+    pthread_mutex_t storage_lock;
+    bool flushing;
+    pthread_cond_t flushed;
+    // Set when the storage was written since it was last synced durably.
+    bool unsynced;
+    pthread_t flusher;
+    bool flusher_running;
+    bool flusher_stopping;
+    FlusherConfig flusher_config;
+    FileMemStats stats;
+    TraceWriter trace;
+    // Commit last written to the file, which new readers load.
+    uint64_t written_sequence;
+    // Cells freed by a shared writer that readers may still reach, by commit.
+    _RetiredCell *retired;
+    size_t retired_count;
+    size_t retired_capacity;
+    // Commit in which retired cells were last found to be still reachable.
+    uint64_t reclaim_sequence;
+    _SuperblockTrailer trailer;
 };
 
 #define FILE_CELL_SIZE sizeof(FileCell)
-#define CONTROL_INFO_SIZE sizeof(_ControlInfo)
+#define SUPERBLOCK_MAGIC 0x4c4d4d53u
+#define SUPERBLOCK_VERSION 1u
+#define SUPERBLOCK_HEADER_SIZE sizeof(_SuperblockHeader)
+#define CHECKSUM_SIZE sizeof(uint32_t)
+#define SUPERBLOCK_TRAILER_SIZE sizeof(_SuperblockTrailer)
+#define MAX_INDEX_SIZE (SUPERBLOCK_SIZE - SUPERBLOCK_HEADER_SIZE - SUPERBLOCK_TRAILER_SIZE - CHECKSUM_SIZE)
+#define TRAILER_OFFSET (SUPERBLOCK_SIZE - CHECKSUM_SIZE - SUPERBLOCK_TRAILER_SIZE)
+#define CELLS_OFFSET (2 * SUPERBLOCK_SIZE)
+#define FLUSH_BATCH 32
+// Readers lock the byte at this offset plus the sequence number of the commit
+// they loaded, far past the end of any file. The byte for sequence 0, which
+// no commit has, is locked while a reader loads a commit.
+#define READER_LOCK_OFFSET ((off_t)1 << 48)
+// Open file description locks belong to the descriptor, so that the writer
+// also sees the readers in its own process. Other systems only have locks
+// that belong to the process, which hide those readers from the writer, and
+// are released when the process closes any descriptor of the file.
+#ifdef __linux__
+#define READER_SETLK F_OFD_SETLK
+#define READER_GETLK F_OFD_GETLK
+#else
+#define READER_SETLK F_SETLK
+#define READER_GETLK F_GETLK
+#endif
 
 // Maps virtual cell references (1, 2, ...) into cell positions in the file.
 long virtual_to_real(FileMem file_mem, FileCell file_cell) {
-    return CONTROL_INFO_SIZE + file_mem->control_info.index_size + (file_cell - 1) * file_mem->control_info.cell_size;
+    return CELLS_OFFSET + (long)(file_cell - 1) * file_mem->control_info.cell_size;
 }
 
-// Reads the control_info from the file.
-void readControlInfo(FileMem file_mem) {
-    fseek(file_mem->file, 0L, SEEK_SET);
-    fread((void *)&file_mem->control_info, CONTROL_INFO_SIZE, 1, file_mem->file);
+// Computes the CRC-32 of size bytes starting at data.
+static uint32_t checksum(const unsigned char *data, size_t size) {
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
 }
 
-// Writes the control_info to the file.
-void write_control_info(FileMem file_mem) {
-    fseek(file_mem->file, 0L, SEEK_SET);
-    fwrite((void *)&file_mem->control_info, CONTROL_INFO_SIZE, 1, file_mem->file);
+// Returns the position in the file of the slot that stores the superblock with
+// the specified sequence number. Consecutive commits alternate between slots.
+static long slot_offset(uint64_t sequence) {
+    return (long)(sequence % 2) * SUPERBLOCK_SIZE;
 }
 
-// Reads from the specified file the cell reference stored in the cell whose
-// reference is file_cell, and returns it.
-FileCell get_next_file_cell(FileMem file_mem, FileCell file_cell) {
+// Records an access in the trace of the specified file, if it is traced.
+static void trace(FileMem file_mem, TraceOp op, FileCell file_cell) {
+    if (file_mem->trace != NULL) {
+        trace_write(file_mem->trace, op, file_cell);
+    }
+}
+
+// Reads size bytes at offset from the storage of the specified file.
+static bool storage_read(FileMem file_mem, long offset, void *buffer, size_t size) {
+    file_mem->stats.bytes_read += size;
+    pthread_mutex_lock(&file_mem->storage_lock);
+    bool read = file_mem->backend->read_at(file_mem->storage, offset, buffer, size);
+    pthread_mutex_unlock(&file_mem->storage_lock);
+    return read;
+}
+
+// Accounts for size bytes at offset that the kernel copied from the storage of
+// the specified file, as if they had been read.
+static void storage_copied(FileMem file_mem, long offset, size_t size) {
+    file_mem->stats.storage_reads++;
+    file_mem->stats.bytes_read += size;
+    if (file_mem->backend->copied != NULL) {
+        pthread_mutex_lock(&file_mem->storage_lock);
+        file_mem->backend->copied(file_mem->storage, offset, size);
+        pthread_mutex_unlock(&file_mem->storage_lock);
+    }
+}
+
+// Writes size bytes at offset to the storage of the specified file.
+static bool storage_write(FileMem file_mem, long offset, const void *buffer, size_t size) {
+    file_mem->stats.bytes_written += size;
+    file_mem->unsynced = true;
+    pthread_mutex_lock(&file_mem->storage_lock);
+    bool written = file_mem->backend->write_at(file_mem->storage, offset, buffer, size);
+    pthread_mutex_unlock(&file_mem->storage_lock);
+    return written;
+}
+
+// Extends the storage of the specified file to at least size bytes.
+static void storage_grow(FileMem file_mem, long size) {
+    pthread_mutex_lock(&file_mem->storage_lock);
+    file_mem->backend->grow(file_mem->storage, size);
+    pthread_mutex_unlock(&file_mem->storage_lock);
+}
+
+// Flushes the writes made to the storage of the specified file and, if durable
+// is true, waits until they are on stable storage.
+static void storage_sync(FileMem file_mem, bool durable) {
+    pthread_mutex_lock(&file_mem->storage_lock);
+    file_mem->backend->sync(file_mem->storage, durable);
+    pthread_mutex_unlock(&file_mem->storage_lock);
+    if (durable) {
+        file_mem->unsynced = false;
+    }
+}
+
+// Returns true if the specified control_info describes a file that can be
+// opened: its index fits in a superblock, its cells can hold a cell reference,
+// the offsets of its cells do not overflow, and its free list starts at one
+// of them.
+static bool valid_control_info(const _ControlInfo *control_info) {
+    return control_info->index_size >= 0 && (size_t)control_info->index_size <= MAX_INDEX_SIZE &&
+           control_info->cell_size >= (int)FILE_CELL_SIZE && control_info->num_cells >= 0 &&
+           control_info->num_cells < (LONG_MAX - CELLS_OFFSET) / control_info->cell_size &&
+           control_info->free_cells >= 0 && control_info->free_cells <= control_info->num_cells;
+}
+
+// Reads the superblock slot at offset into slot, and returns true iff it holds
+// a complete and valid commit.
+static bool read_slot(FileMem file_mem, long offset, unsigned char *slot, _SuperblockHeader *header) {
+    uint32_t stored;
+    if (!storage_read(file_mem, offset, slot, SUPERBLOCK_SIZE)) {
+        return false;
+    }
+    memcpy(header, slot, SUPERBLOCK_HEADER_SIZE);
+    memcpy(&stored, slot + SUPERBLOCK_SIZE - CHECKSUM_SIZE, CHECKSUM_SIZE);
+    return header->magic == SUPERBLOCK_MAGIC && header->version == SUPERBLOCK_VERSION &&
+           valid_control_info(&header->control_info) && stored == checksum(slot, SUPERBLOCK_SIZE - CHECKSUM_SIZE);
+}
+
+// Reads the newest valid superblock slot of the file into slot. Returns false
+// if neither slot holds a valid superblock.
+static bool read_newest_slot(FileMem file_mem, unsigned char *slot, _SuperblockHeader *header) {
+    unsigned char slots[2][SUPERBLOCK_SIZE];
+    _SuperblockHeader headers[2];
+    int newest = -1;
+    for (int i = 0; i < 2; i++) {
+        if (read_slot(file_mem, i * SUPERBLOCK_SIZE, slots[i], &headers[i]) &&
+            (newest < 0 || headers[i].sequence > headers[newest].sequence)) {
+            newest = i;
+        }
+    }
+    if (newest < 0) {
+        return false;
+    }
+    memcpy(slot, slots[newest], SUPERBLOCK_SIZE);
+    *header = headers[newest];
+    return true;
+}
+
+// Sets or, if type is F_UNLCK, clears the lock of a shared reader of the
+// specified file on the byte that stands for sequence. A reader whose backend
+// has no file descriptor reads a private copy, so it needs no lock.
+static bool lock_sequence(FileMem file_mem, short type, uint64_t sequence) {
+    struct flock lock = {.l_type = type, .l_whence = SEEK_SET, .l_start = READER_LOCK_OFFSET + (off_t)sequence,
+                         .l_len = 1};
+    int fd = file_mem->backend->fd(file_mem->storage);
+    return fd < 0 || fcntl(fd, READER_SETLK, &lock) == 0;
+}
+
+// Returns true if a shared reader of the specified file may hold a commit
+// older than sequence, or is loading a commit.
+static bool readers_before(FileMem file_mem, uint64_t sequence) {
+    struct flock lock = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = READER_LOCK_OFFSET,
+                         .l_len = (off_t)sequence};
+    int fd = file_mem->backend->fd(file_mem->storage);
+    return fd >= 0 && (fcntl(fd, READER_GETLK, &lock) != 0 || lock.l_type != F_UNLCK);
+}
+
+// Reads the newest valid superblock slot of the file into slot like
+// read_newest_slot and, for a shared reader, locks its commit, so that the
+// writer does not reuse the cells it reaches until the reader moves past it.
+static bool pin_newest_slot(FileMem file_mem, unsigned char *slot, _SuperblockHeader *header) {
+    if (file_mem->mode != FILE_MEM_SHARED_READER) {
+        return read_newest_slot(file_mem, slot, header);
+    }
+    if (!lock_sequence(file_mem, F_RDLCK, 0)) {
+        return false;
+    }
+    bool pinned = read_newest_slot(file_mem, slot, header) && lock_sequence(file_mem, F_RDLCK, header->sequence);
+    lock_sequence(file_mem, F_UNLCK, 0);
+    return pinned;
+}
+
+// Reads the newest valid superblock from the file, loading the control_info
+// and the index. Returns false if neither slot holds a valid superblock.
+bool read_superblock(FileMem file_mem) {
+    unsigned char slot[SUPERBLOCK_SIZE];
+    _SuperblockHeader header;
+    if (!pin_newest_slot(file_mem, slot, &header)) {
+        return false;
+    }
+    file_mem->control_info = header.control_info;
+    file_mem->sequence = header.sequence;
+    file_mem->header_dirty = false;
+    file_mem->index = malloc(file_mem->control_info.index_size);
+    memcpy(file_mem->index, slot + SUPERBLOCK_HEADER_SIZE, file_mem->control_info.index_size);
+    memcpy(&file_mem->trailer, slot + TRAILER_OFFSET, SUPERBLOCK_TRAILER_SIZE);
+    return true;
+}
+
+// Writes the latest commit to the file, unless there are cached cells that
+// were dirtied before it and have not been written back yet. The cells are
+// first synced to stable storage, so that a crash cannot leave a superblock
+// that refers to cells that were lost. Backends without a file descriptor
+// write the whole file at once, so they need not be synced. The superblock is
+// written as a single block to the slot that does not hold the previous
+// commit, so a torn write leaves the previous commit intact. Returns true if
+// the superblock was written.
+static bool write_pending_superblock(FileMem file_mem) {
+    if (!file_mem->header_pending ||
+        (file_mem->cache != NULL && cell_cache_oldest_sequence(file_mem->cache) <= file_mem->sequence)) {
+        return false;
+    }
+    if (file_mem->unsynced && file_mem->backend->fd(file_mem->storage) >= 0) {
+        storage_sync(file_mem, true);
+    }
+    storage_write(file_mem, slot_offset(file_mem->sequence), file_mem->pending, SUPERBLOCK_SIZE);
+    file_mem->stats.control_info_writes++;
+    trace(file_mem, TRACE_WRITE_CONTROL_INFO, (FileCell)(file_mem->sequence % 2));
+    file_mem->header_pending = false;
+    file_mem->written_sequence = file_mem->sequence;
+    if (file_mem->mode == FILE_MEM_SHARED_WRITER) {
+        // Make the commit visible to readers in other processes.
+        storage_sync(file_mem, false);
+    }
+    return true;
+}
+
+// Commits the control_info and the index, and writes them to the file as soon
+// as the cells they refer to are in the file.
+void write_superblock(FileMem file_mem) {
+    _SuperblockHeader header;
+    memset(file_mem->pending, 0, SUPERBLOCK_SIZE);
+    memset(&header, 0, SUPERBLOCK_HEADER_SIZE);
+    header.magic = SUPERBLOCK_MAGIC;
+    header.version = SUPERBLOCK_VERSION;
+    header.sequence = file_mem->sequence + 1;
+    header.control_info = file_mem->control_info;
+    memcpy(file_mem->pending, &header, SUPERBLOCK_HEADER_SIZE);
+    memcpy(file_mem->pending + SUPERBLOCK_HEADER_SIZE, file_mem->index, file_mem->control_info.index_size);
+    memcpy(file_mem->pending + TRAILER_OFFSET, &file_mem->trailer, SUPERBLOCK_TRAILER_SIZE);
+    file_mem_seal_superblock(file_mem->pending);
+
+    file_mem->sequence = header.sequence;
+    file_mem->header_dirty = false;
+    file_mem->header_pending = true;
+    write_pending_superblock(file_mem);
+}
+
+// Stores in the last bytes of slot, a superblock slot of SUPERBLOCK_SIZE bytes,
+// the checksum of the bytes before them, which completes the slot.
+void file_mem_seal_superblock(void *slot) {
+    uint32_t sum = checksum(slot, SUPERBLOCK_SIZE - CHECKSUM_SIZE);
+    memcpy((unsigned char *)slot + SUPERBLOCK_SIZE - CHECKSUM_SIZE, &sum, CHECKSUM_SIZE);
+}
+
+// Returns the value of a monotonic clock in milliseconds.
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+// Reads the cell whose reference is file_cell directly from the file.
+static void raw_read_cell(FileMem file_mem, FileCell file_cell, void *cell) {
+    file_mem->stats.storage_reads++;
+    storage_read(file_mem, virtual_to_real(file_mem, file_cell), cell, file_mem->control_info.cell_size);
+}
+
+// Writes the cell whose reference is file_cell directly to the file.
+static void raw_write_cell(FileMem file_mem, FileCell file_cell, const void *cell) {
+    file_mem->stats.storage_writes++;
+    storage_write(file_mem, virtual_to_real(file_mem, file_cell), cell, file_mem->control_info.cell_size);
+}
+
+// Writes back a dirty cell evicted or flushed from the cache.
+static void write_back_cell(void *context, FileCell file_cell, const void *cell) {
+    raw_write_cell((FileMem)context, file_cell, cell);
+}
+
+// Reads the cell whose reference is file_cell, through the cache if enabled.
+static void load_cell(FileMem file_mem, FileCell file_cell, void *cell) {
+    if (file_mem->cache == NULL) {
+        raw_read_cell(file_mem, file_cell, cell);
+    } else if (!cell_cache_read(file_mem->cache, file_cell, cell)) {
+        raw_read_cell(file_mem, file_cell, cell);
+        cell_cache_fill(file_mem->cache, file_cell, cell);
+    }
+}
+
+// Returns the number of dirty cells above which the flusher writes cells back
+// regardless of their age.
+static size_t dirty_limit(FileMem file_mem) {
+    return (size_t)(file_mem->flusher_config.dirty_ratio * cell_cache_capacity(file_mem->cache));
+}
+
+// Writes the cell whose reference is file_cell, through the cache if enabled.
+// The cell belongs to the commit that follows the latest one.
+static void store_cell(FileMem file_mem, FileCell file_cell, const void *cell) {
+    if (file_mem->cache == NULL) {
+        raw_write_cell(file_mem, file_cell, cell);
+        return;
+    }
+    cell_cache_write(file_mem->cache, file_cell, cell, file_mem->sequence + 1, now_ms());
+    if (file_mem->flusher_running && cell_cache_dirty(file_mem->cache) > dirty_limit(file_mem)) {
+        pthread_cond_signal(&file_mem->wakeup);
+    }
+}
+
+// Writes every dirty cell back, commits any pending change to the control_info
+// and writes the latest commit to the file. A batch the flusher is writing is
+// waited for, since its cells may have been written to since it was taken.
+static void flush_all(FileMem file_mem) {
+    while (file_mem->flushing) {
+        pthread_cond_wait(&file_mem->flushed, &file_mem->lock);
+    }
+    if (file_mem->cache != NULL) {
+        cell_cache_write_back(file_mem->cache, SIZE_MAX, UINT64_MAX);
+    }
+    if (file_mem->header_dirty) {
+        write_superblock(file_mem);
+    }
+    write_pending_superblock(file_mem);
+    storage_sync(file_mem, false);
+}
+
+// Writes back the count cells copied from the cache into cells, whose
+// references are in file_cells, while the lock of the specified file is
+// released, so that foreground operations only wait for the storage when they
+// miss the cache. Records in written which writes succeeded, and returns how
+// many did.
+static size_t write_batch(FileMem file_mem, const FileCell *file_cells, const unsigned char *cells, bool *written,
+                          size_t count) {
+    int cell_size = file_mem->control_info.cell_size;
+    size_t succeeded = 0;
+    file_mem->flushing = true;
+    pthread_mutex_unlock(&file_mem->lock);
+    for (size_t i = 0; i < count; i++) {
+        pthread_mutex_lock(&file_mem->storage_lock);
+        written[i] = file_mem->backend->write_at(file_mem->storage, virtual_to_real(file_mem, file_cells[i]),
+                                                 cells + i * cell_size, cell_size);
+        pthread_mutex_unlock(&file_mem->storage_lock);
+        succeeded += written[i];
+    }
+    pthread_mutex_lock(&file_mem->lock);
+    file_mem->flushing = false;
+    pthread_cond_broadcast(&file_mem->flushed);
+    file_mem->stats.storage_writes += succeeded;
+    file_mem->stats.failed_writes += count - succeeded;
+    file_mem->stats.bytes_written += succeeded * cell_size;
+    file_mem->unsynced = true;
+    return succeeded;
+}
+
+// Writes back, in small batches, the dirty cells that exceed the dirty ratio
+// or are older than the maximum age. The lock is released while a batch is
+// written, and between batches, so that foreground operations are never
+// stalled behind a long flush. A batch with failed writes ends the pass. The
+// storage is only synced when the pass wrote something.
+static void flusher_pass(FileMem file_mem) {
+    FileCell file_cells[FLUSH_BATCH];
+    unsigned char cells[FLUSH_BATCH * file_mem->control_info.cell_size];
+    bool succeeded[FLUSH_BATCH];
+    size_t written;
+    do {
+        uint64_t now = now_ms();
+        uint64_t dirtied_before = now > file_mem->flusher_config.max_age_ms ? now - file_mem->flusher_config.max_age_ms : 0;
+        if (cell_cache_dirty(file_mem->cache) > dirty_limit(file_mem)) {
+            dirtied_before = UINT64_MAX;
+        }
+        size_t taken = cell_cache_take_dirty(file_mem->cache, FLUSH_BATCH, dirtied_before, file_cells, cells);
+        if (taken > 0) {
+            written = write_batch(file_mem, file_cells, cells, succeeded, taken);
+            cell_cache_written(file_mem->cache, file_cells, succeeded, taken);
+        } else {
+            // A cache of a single cell cannot spare it.
+            written = cell_cache_write_back(file_mem->cache, FLUSH_BATCH, dirtied_before);
+        }
+        if (write_pending_superblock(file_mem) || written > 0) {
+            storage_sync(file_mem, false);
+        }
+        if (written > 0) {
+            pthread_mutex_unlock(&file_mem->lock);
+            sched_yield();
+            pthread_mutex_lock(&file_mem->lock);
+        }
+    } while (written == FLUSH_BATCH && !file_mem->flusher_stopping);
+}
+
+// Body of the background flusher thread.
+static void *flusher_main(void *argument) {
+    FileMem file_mem = (FileMem)argument;
+    pthread_mutex_lock(&file_mem->lock);
+    while (!file_mem->flusher_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += file_mem->flusher_config.interval_ms / 1000;
+        deadline.tv_nsec += (long)(file_mem->flusher_config.interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&file_mem->wakeup, &file_mem->lock, &deadline);
+        if (!file_mem->flusher_stopping) {
+            flusher_pass(file_mem);
+        }
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return NULL;
+}
+
+// Aborts the program if the specified file was opened as a shared reader.
+static void check_writable(FileMem file_mem, const char *operation) {
+    if (file_mem->mode == FILE_MEM_SHARED_READER) {
+        printf("Read-only FileMem when %s.\n", operation);
+        exit(1);
+    }
+}
+
+// Takes the advisory lock that makes the calling process the only writer of
+// the specified file. Returns false if another writer holds it.
+static bool lock_writer(FileMem file_mem) {
+    if (file_mem->mode != FILE_MEM_SHARED_WRITER) {
+        return true;
+    }
+    int fd = file_mem->backend->fd(file_mem->storage);
+    return fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0;
+}
+
+// Initializes the locks of a FileMem, before its storage is accessed.
+static void init_locks(FileMem file_mem) {
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&file_mem->wakeup, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&file_mem->lock, NULL);
+    pthread_mutex_init(&file_mem->storage_lock, NULL);
+    pthread_cond_init(&file_mem->flushed, NULL);
+    file_mem->flushing = false;
+    file_mem->unsynced = false;
+}
+
+// Destroys the locks of a FileMem.
+static void destroy_locks(FileMem file_mem) {
+    pthread_cond_destroy(&file_mem->wakeup);
+    pthread_mutex_destroy(&file_mem->lock);
+    pthread_mutex_destroy(&file_mem->storage_lock);
+    pthread_cond_destroy(&file_mem->flushed);
+}
+
+// Initializes the fields of a FileMem that do not depend on its file.
+static void init_file_mem(FileMem file_mem) {
+    file_mem->header_pending = false;
+    file_mem->cache = NULL;
+    file_mem->flusher_running = false;
+    file_mem->flusher_stopping = false;
+    memset(&file_mem->stats, 0, sizeof(FileMemStats));
+    file_mem->trace = NULL;
+    file_mem->written_sequence = file_mem->sequence;
+    file_mem->retired = NULL;
+    file_mem->retired_count = 0;
+    file_mem->retired_capacity = 0;
+    file_mem->reclaim_sequence = 0;
+}
+
+// Returns the cell reference stored in the cell whose reference is file_cell.
+static FileCell load_link(FileMem file_mem, FileCell file_cell) {
     FileCell nexFileCell;
-    fseek(file_mem->file, virtual_to_real(file_mem, file_cell), SEEK_SET);
-    fread((void *)&nexFileCell, FILE_CELL_SIZE, 1, file_mem->file);
+    unsigned char cell[file_mem->control_info.cell_size];
+    load_cell(file_mem, file_cell, cell);
+    memcpy(&nexFileCell, cell, FILE_CELL_SIZE);
     return nexFileCell;
 }
 
+// Links the cell whose reference is file_cell at the head of the free list.
+static void push_free_cell(FileMem file_mem, FileCell file_cell) {
+    unsigned char cell[file_mem->control_info.cell_size];
+    memset(cell, 0, file_mem->control_info.cell_size);
+    memcpy(cell, &file_mem->control_info.free_cells, FILE_CELL_SIZE);
+    store_cell(file_mem, file_cell, cell);
+    file_mem->control_info.free_cells = file_cell;
+    file_mem->header_dirty = true;
+}
+
+// Records that a shared writer freed the count cells whose references are in
+// file_cells in the commit with the specified sequence number, which is never
+// older than that of the cells already retired. They are left as they are
+// until no reader can reach them.
+static void retire_cells(FileMem file_mem, const FileCell *file_cells, int count, uint64_t sequence) {
+    if (file_mem->retired_count + count > file_mem->retired_capacity) {
+        size_t capacity = file_mem->retired_capacity == 0 ? 64 : 2 * file_mem->retired_capacity;
+        while (capacity < file_mem->retired_count + count) {
+            capacity *= 2;
+        }
+        file_mem->retired = realloc(file_mem->retired, capacity * sizeof(_RetiredCell));
+        file_mem->retired_capacity = capacity;
+    }
+    for (int i = 0; i < count; i++) {
+        file_mem->retired[file_mem->retired_count].cell = file_cells[i];
+        file_mem->retired[file_mem->retired_count++].sequence = sequence;
+    }
+}
+
+// Returns true if a reader of the specified file may still reach the cells
+// unlinked by the commit with the specified sequence number: either that
+// commit has not been written yet, or a reader holds an older one.
+static bool retired_reachable(FileMem file_mem, uint64_t sequence) {
+    return sequence > file_mem->written_sequence || readers_before(file_mem, sequence);
+}
+
+// Moves to the free list the retired cells of the specified file that no
+// reader can reach any more. Cells are retired in commit order, so those are
+// a prefix of them, found with a few lock queries.
+static void reclaim_retired(FileMem file_mem) {
+    size_t low = 0;
+    size_t high = file_mem->retired_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (retired_reachable(file_mem, file_mem->retired[middle].sequence)) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    for (size_t i = 0; i < low; i++) {
+        push_free_cell(file_mem, file_mem->retired[i].cell);
+    }
+    file_mem->retired_count -= low;
+    memmove(file_mem->retired, file_mem->retired + low, file_mem->retired_count * sizeof(_RetiredCell));
+    if (file_mem->retired_count > 0) {
+        file_mem->reclaim_sequence = file_mem->sequence;
+    }
+}
+
+// Reads from the specified file the cell reference stored in the cell whose
+// reference is file_cell, and returns it. For a free cell, that is the next
+// cell in the free list.
+FileCell get_next_file_cell(FileMem file_mem, FileCell file_cell) {
+    pthread_mutex_lock(&file_mem->lock);
+    FileCell next_file_cell = load_link(file_mem, file_cell);
+    pthread_mutex_unlock(&file_mem->lock);
+    return next_file_cell;
+}
+
 // Creates and opens a file whose name is the string pointed to by file_name, if
 // the file does not exist, otherwise returns NULL. The index has index_size
 // bytes, and cells have cell_size bytes. Pre-condition: cell_size >= 4.
 FileMem create_file(const char *file_name, int index_size, int cell_size) {
-    FileMem file_mem = malloc(sizeof(struct _FileMem));
+    return create_file_with_options(file_name, index_size, cell_size, NULL);
+}
 
-    // Check if the file already exists.
-    file_mem->file = fopen(file_name, "r");
-    if (file_mem->file != NULL) {
-        // If so, abort the operation.
-        fclose(file_mem->file);
-        free(file_mem);
+// Opens the file whose name is the string pointed to by file_name, if the file
+// exists and holds a valid superblock, otherwise, returns NULL.
+FileMem open_file(const char *file_name) {
+    return open_file_with_options(file_name, NULL);
+}
+
+// Returns the number of cell references that a cell of the specified file
+// holds after the link to the next cell of a chain.
+static int references_per_cell(FileMem file_mem) {
+    return file_mem->control_info.cell_size / (int)FILE_CELL_SIZE - 1;
+}
+
+// Lists the cells of the specified file that are still retired in a chain of
+// new cells that the trailer of the next commit refers to, so that the next
+// writer to open the file can take them back. Cells too small to hold a
+// reference besides the link cannot list them, and they are then leaked.
+static void store_retired(FileMem file_mem) {
+    int per_cell = references_per_cell(file_mem);
+    if (per_cell == 0) {
+        return;
+    }
+    unsigned char cell[file_mem->control_info.cell_size];
+    FileCell chain = NULL_CELL;
+    for (size_t done = 0; done < file_mem->retired_count; done += per_cell) {
+        memset(cell, 0, file_mem->control_info.cell_size);
+        memcpy(cell, &chain, FILE_CELL_SIZE);
+        for (size_t i = 0; i < (size_t)per_cell && done + i < file_mem->retired_count; i++) {
+            memcpy(cell + (i + 1) * FILE_CELL_SIZE, &file_mem->retired[done + i].cell, FILE_CELL_SIZE);
+        }
+        // The free list only holds cells that no reader reaches.
+        if (file_mem->control_info.free_cells == NULL_CELL) {
+            chain = ++file_mem->control_info.num_cells;
+            storage_grow(file_mem, virtual_to_real(file_mem, chain + 1));
+        } else {
+            chain = file_mem->control_info.free_cells;
+            file_mem->control_info.free_cells = load_link(file_mem, chain);
+        }
+        store_cell(file_mem, chain, cell);
+    }
+    file_mem->trailer.retired_cells = chain;
+    file_mem->trailer.retired_sequence = file_mem->retired[file_mem->retired_count - 1].sequence;
+    file_mem->retired_count = 0;
+    file_mem->header_dirty = true;
+}
+
+// Takes back the cells listed by the chain that the trailer of the latest
+// commit of the specified file refers to. A shared writer retires them again,
+// as readers may still reach them, while other writers free them. The cells of
+// the chain are freed, and the next commit no longer refers to it. A damaged
+// chain is followed up to the first reference to no cell.
+static void load_retired(FileMem file_mem) {
+    int per_cell = references_per_cell(file_mem);
+    unsigned char cell[file_mem->control_info.cell_size];
+    FileCell chain = file_mem->trailer.retired_cells;
+    while (chain > 0 && chain <= file_mem->control_info.num_cells) {
+        load_cell(file_mem, chain, cell);
+        for (int i = 1; i <= per_cell; i++) {
+            FileCell retired;
+            memcpy(&retired, cell + i * FILE_CELL_SIZE, FILE_CELL_SIZE);
+            if (retired <= 0 || retired > file_mem->control_info.num_cells) {
+                break;
+            }
+            if (file_mem->mode == FILE_MEM_SHARED_WRITER) {
+                retire_cells(file_mem, &retired, 1, file_mem->trailer.retired_sequence);
+            } else {
+                push_free_cell(file_mem, retired);
+            }
+        }
+        push_free_cell(file_mem, chain);
+        memcpy(&chain, cell, FILE_CELL_SIZE);
+    }
+    memset(&file_mem->trailer, 0, SUPERBLOCK_TRAILER_SIZE);
+    file_mem->header_dirty = true;
+}
+
+// Creates and opens a file like create_file, configured by options, which may
+// be NULL. Returns NULL if the file could not be created in the requested mode.
+FileMem create_file_with_options(const char *file_name, int index_size, int cell_size,
+                                 const FileMemOptions *options) {
+    FileMemMode mode = options == NULL ? FILE_MEM_PRIVATE : options->mode;
+    if (index_size < 0 || (size_t)index_size > MAX_INDEX_SIZE || mode == FILE_MEM_SHARED_READER) {
         return NULL;
     }
 
-    file_mem->file = fopen(file_name, "w+");
-    if (file_mem->file != NULL) {
+    FileMem file_mem = malloc(sizeof(struct _FileMem));
+    file_mem->backend = options == NULL || options->backend == NULL ? &stdio_backend : options->backend;
+    file_mem->mode = mode;
+    init_locks(file_mem);
+
+    // Fails if the file already exists.
+    file_mem->storage = file_mem->backend->open(file_mem->backend, file_name, true, false);
+    if (file_mem->storage != NULL && lock_writer(file_mem) && file_mem->backend->grow(file_mem->storage, CELLS_OFFSET)) {
         file_mem->control_info.index_size = index_size;
         file_mem->control_info.cell_size = cell_size;
         file_mem->control_info.num_cells = 0;
         file_mem->control_info.free_cells = 0;
+        file_mem->index = calloc(1, index_size);
+        file_mem->sequence = 0;
+        memset(&file_mem->trailer, 0, SUPERBLOCK_TRAILER_SIZE);
+        init_file_mem(file_mem);
+        write_superblock(file_mem);
         return file_mem;
     } else {
+        if (file_mem->storage != NULL) {
+            file_mem->backend->close(file_mem->storage);
+        }
+        destroy_locks(file_mem);
         free(file_mem);
         return NULL;
     }
 }
 
-// Opens the file whose name is the string pointed to by file_name, if the file
-// exists, otherwise, returns NULL.
-FileMem open_file(const char *file_name) {
+// Opens a file like open_file, configured by options, which may be NULL.
+// Returns NULL if the file could not be opened in the requested mode.
+FileMem open_file_with_options(const char *file_name, const FileMemOptions *options) {
     FileMem file_mem = (FileMem)malloc(sizeof(struct _FileMem));
-    file_mem->file = fopen(file_name, "r+");
-    if (file_mem->file != NULL) {
-        readControlInfo(file_mem);
-        return file_mem;
-    } else {
-        free((void *)file_mem);
-        return NULL;
+    file_mem->mode = options == NULL ? FILE_MEM_PRIVATE : options->mode;
+    file_mem->backend = options == NULL || options->backend == NULL ? &stdio_backend : options->backend;
+    init_locks(file_mem);
+    file_mem->storage = file_mem->backend->open(file_mem->backend, file_name, false,
+                                                file_mem->mode == FILE_MEM_SHARED_READER);
+    if (file_mem->storage != NULL) {
+        if (lock_writer(file_mem) && read_superblock(file_mem)) {
+            init_file_mem(file_mem);
+            if (file_mem->mode != FILE_MEM_SHARED_READER && file_mem->trailer.retired_cells != NULL_CELL) {
+                load_retired(file_mem);
+            }
+            return file_mem;
+        }
+        file_mem->backend->close(file_mem->storage);
     }
+    destroy_locks(file_mem);
+    free((void *)file_mem);
+    return NULL;
 }
 
 // Closes the specified file.
 void close_file(FileMem file_mem) {
-    write_control_info(file_mem);
-    fclose(file_mem->file);
+    file_mem_stop_flusher(file_mem);
+    flush_all(file_mem);
+    if (file_mem->retired_count > 0) {
+        reclaim_retired(file_mem);
+        if (file_mem->retired_count > 0) {
+            store_retired(file_mem);
+        }
+        flush_all(file_mem);
+    }
+    file_mem_stop_trace(file_mem);
+    file_mem->backend->close(file_mem->storage);
+    if (file_mem->cache != NULL) {
+        cell_cache_destroy(file_mem->cache);
+    }
+    destroy_locks(file_mem);
+    free(file_mem->index);
+    free(file_mem->retired);
     free((void *)file_mem);
 }
 
 // Reads the index from the specified file, storing it at the location given by
 // index.
 void read_index(FileMem file_mem, void *idx) {
-    fseek(file_mem->file, CONTROL_INFO_SIZE, SEEK_SET);
-    fread(idx, file_mem->control_info.index_size, 1, file_mem->file);
+    pthread_mutex_lock(&file_mem->lock);
+    trace(file_mem, TRACE_READ_INDEX, NULL_CELL);
+    memcpy(idx, file_mem->index, file_mem->control_info.index_size);
+    pthread_mutex_unlock(&file_mem->lock);
 }
 
 // Writes the index to the specified file, obtaining it from the location given
-// by index.
+// by index. The index is committed together with the control_info, including
+// any cells allocated or freed since the previous commit. Nothing is written if
+// neither changed since then.
 void write_index(FileMem file_mem, void *idx) {
-    fseek(file_mem->file, CONTROL_INFO_SIZE, SEEK_SET);
-    fwrite(idx, file_mem->control_info.index_size, 1, file_mem->file);
+    pthread_mutex_lock(&file_mem->lock);
+    trace(file_mem, TRACE_WRITE_INDEX, NULL_CELL);
+    if (file_mem->header_dirty || memcmp(file_mem->index, idx, file_mem->control_info.index_size) != 0) {
+        check_writable(file_mem, "writing the index");
+        memcpy(file_mem->index, idx, file_mem->control_info.index_size);
+        file_mem->stats.index_writes++;
+        write_superblock(file_mem);
+    }
+    pthread_mutex_unlock(&file_mem->lock);
 }
 
 // Reads from the specified file the cell whose reference is file_cell, storing
@@ -112,8 +835,11 @@ void read_cell(FileMem file_mem, FileCell file_cell, void *cell) {
         printf("Illegal FileCell: %d when reading.\n", file_cell);
         exit(1);
     }
-    fseek(file_mem->file, virtual_to_real(file_mem, file_cell), SEEK_SET);
-    fread(cell, file_mem->control_info.cell_size, 1, file_mem->file);
+    pthread_mutex_lock(&file_mem->lock);
+    file_mem->stats.cell_reads++;
+    trace(file_mem, TRACE_READ_CELL, file_cell);
+    load_cell(file_mem, file_cell, cell);
+    pthread_mutex_unlock(&file_mem->lock);
 }
 
 // Writes to the specified file the cell whose reference is file_cell, obtaining
@@ -123,29 +849,447 @@ void write_cell(FileMem file_mem, FileCell file_cell, void *cell) {
         printf("Illegal FileCell: %d when writing: %p\n", file_cell, cell);
         exit(1);
     }
-    fseek(file_mem->file, virtual_to_real(file_mem, file_cell), SEEK_SET);
-    fwrite(cell, file_mem->control_info.cell_size, 1, file_mem->file);
+    check_writable(file_mem, "writing a cell");
+    pthread_mutex_lock(&file_mem->lock);
+    file_mem->stats.cell_writes++;
+    trace(file_mem, TRACE_WRITE_CELL, file_cell);
+    store_cell(file_mem, file_cell, cell);
+    pthread_mutex_unlock(&file_mem->lock);
 }
 
 // Allocates memory to a new cell in the specified file, and returns a reference
-// to it.
+// to it. The allocation becomes durable with the next write_index.
 FileCell new_cell(FileMem file_mem) {
     FileCell file_cell;
+    check_writable(file_mem, "allocating a cell");
+    pthread_mutex_lock(&file_mem->lock);
+    if (file_mem->control_info.free_cells == 0 && file_mem->retired_count > 0 &&
+        file_mem->reclaim_sequence != file_mem->sequence) {
+        reclaim_retired(file_mem);
+    }
     if (file_mem->control_info.free_cells == 0) {
         file_cell = ++file_mem->control_info.num_cells;
+        storage_grow(file_mem, virtual_to_real(file_mem, file_cell + 1));
+        file_mem->stats.file_extensions++;
     } else {
         file_cell = file_mem->control_info.free_cells;
-        file_mem->control_info.free_cells = get_next_file_cell(file_mem, file_cell);
+        file_mem->control_info.free_cells = load_link(file_mem, file_cell);
+        file_mem->stats.free_list_pops++;
     }
-    write_control_info(file_mem); /* OPTIONAL. */
+    file_mem->header_dirty = true;
+    trace(file_mem, TRACE_NEW_CELL, file_cell);
+    pthread_mutex_unlock(&file_mem->lock);
     return file_cell;
 }
 
+// Allocates count consecutive new cells at the end of the specified file,
+// bypassing the free list, and returns a reference to the first.
+FileCell new_cells(FileMem file_mem, int count) {
+    check_writable(file_mem, "allocating cells");
+    pthread_mutex_lock(&file_mem->lock);
+    FileCell first = file_mem->control_info.num_cells + 1;
+    file_mem->control_info.num_cells += count;
+    storage_grow(file_mem, virtual_to_real(file_mem, file_mem->control_info.num_cells + 1));
+    file_mem->stats.file_extensions += count;
+    file_mem->header_dirty = true;
+    for (FileCell file_cell = first; file_cell < first + count; file_cell++) {
+        trace(file_mem, TRACE_NEW_CELL, file_cell);
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return first;
+}
+
+// Reads from the specified file up to count consecutive cells, starting with
+// the one whose reference is file_cell, storing them at the location given by
+// cells, and returns how many were read: cells past the last one of the file
+// are not. Without a cache, they are read with a single read.
+int read_cells(FileMem file_mem, FileCell file_cell, int count, void *cells) {
+    if (file_cell <= 0) {
+        printf("Illegal FileCell: %d when reading cells.\n", file_cell);
+        exit(1);
+    }
+    pthread_mutex_lock(&file_mem->lock);
+    int cell_size = file_mem->control_info.cell_size;
+    if (count > file_mem->control_info.num_cells - file_cell + 1) {
+        count = file_mem->control_info.num_cells - file_cell + 1;
+    }
+    if (count <= 0) {
+        pthread_mutex_unlock(&file_mem->lock);
+        return 0;
+    }
+    file_mem->stats.cell_reads += count;
+    for (int i = 0; i < count; i++) {
+        trace(file_mem, TRACE_READ_CELL, file_cell + i);
+    }
+    if (file_mem->cache == NULL) {
+        file_mem->stats.storage_reads++;
+        storage_read(file_mem, virtual_to_real(file_mem, file_cell), cells, (size_t)count * cell_size);
+    } else {
+        for (int i = 0; i < count; i++) {
+            load_cell(file_mem, file_cell + i, (unsigned char *)cells + (size_t)i * cell_size);
+        }
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return count;
+}
+
+// Writes to the specified file count consecutive cells, starting with the one
+// whose reference is file_cell, obtaining them from the location given by
+// cells. Without a cache, they are written with a single write.
+void write_cells(FileMem file_mem, FileCell file_cell, int count, const void *cells) {
+    if (file_cell <= 0) {
+        printf("Illegal FileCell: %d when writing cells.\n", file_cell);
+        exit(1);
+    }
+    check_writable(file_mem, "writing cells");
+    pthread_mutex_lock(&file_mem->lock);
+    int cell_size = file_mem->control_info.cell_size;
+    file_mem->stats.cell_writes += count;
+    for (int i = 0; i < count; i++) {
+        trace(file_mem, TRACE_WRITE_CELL, file_cell + i);
+    }
+    if (file_mem->cache == NULL) {
+        file_mem->stats.storage_writes += count;
+        storage_write(file_mem, virtual_to_real(file_mem, file_cell), cells, (size_t)count * cell_size);
+    } else {
+        for (int i = 0; i < count; i++) {
+            store_cell(file_mem, file_cell + i, (const unsigned char *)cells + (size_t)i * cell_size);
+        }
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+}
+
+// Copies size bytes at offset from the storage of the specified file to the
+// file descriptor fd within the kernel, first with copy_file_range, which
+// only accepts a regular file, then with sendfile. Returns the number of bytes
+// copied, which is less than size if neither could copy the rest. Both calls
+// are Linux-only; elsewhere, nothing is copied.
+static size_t storage_send(FileMem file_mem, long offset, size_t size, int fd) {
+#ifdef __linux__
+    int source = file_mem->backend->fd(file_mem->storage);
+    loff_t position = offset;
+    size_t done = 0;
+    bool copy_range = true;
+    while (source >= 0 && done < size) {
+        ssize_t sent = -1;
+        if (copy_range) {
+            sent = copy_file_range(source, &position, fd, NULL, size - done, 0);
+            copy_range = sent > 0;
+        }
+        if (sent <= 0) {
+            off_t sendfile_offset = position;
+            sent = sendfile(fd, source, &sendfile_offset, size - done);
+            if (sent <= 0) {
+                break;
+            }
+            position = sendfile_offset;
+        }
+        storage_copied(file_mem, offset + (long)done, sent);
+        done += sent;
+    }
+    return done;
+#else
+    (void)file_mem;
+    (void)offset;
+    (void)size;
+    (void)fd;
+    return 0;
+#endif
+}
+
+// Writes size bytes at offset from the storage of the specified file to the
+// file descriptor fd, copying them within the kernel when it can, and reading
+// them into a buffer otherwise. Returns false if they could not be completely
+// written.
+static bool storage_send_all(FileMem file_mem, long offset, size_t size, int fd) {
+    unsigned char buffer[64 * 1024];
+    size_t done = storage_send(file_mem, offset, size, fd);
+    bool sent = true;
+    while (done < size && sent) {
+        size_t chunk = size - done < sizeof(buffer) ? size - done : sizeof(buffer);
+        file_mem->stats.storage_reads++;
+        storage_read(file_mem, offset + (long)done, buffer, chunk);
+        for (size_t written = 0; written < chunk && sent;) {
+            ssize_t n = write(fd, buffer + written, chunk - written);
+            sent = n > 0;
+            written += sent ? (size_t)n : 0;
+        }
+        done += chunk;
+    }
+    return sent;
+}
+
+// Writes count consecutive cells of the specified file, starting with the one
+// whose reference is file_cell, to the file descriptor fd, after writing the
+// dirty cells back. The kernel copies them from the file when the backend has
+// a file descriptor; otherwise, or if it cannot, they are read into a buffer
+// and written. Returns false if they could not be completely written.
+bool file_mem_send_cells(FileMem file_mem, FileCell file_cell, int count, int fd) {
+    if (count == 0) {
+        return true;
+    }
+    if (file_cell <= 0) {
+        printf("Illegal FileCell: %d when sending cells.\n", file_cell);
+        exit(1);
+    }
+    pthread_mutex_lock(&file_mem->lock);
+    flush_all(file_mem);
+    file_mem->stats.cell_reads += count;
+    for (int i = 0; i < count; i++) {
+        trace(file_mem, TRACE_READ_CELL, file_cell + i);
+    }
+    bool sent = storage_send_all(file_mem, virtual_to_real(file_mem, file_cell),
+                                 (size_t)count * file_mem->control_info.cell_size, fd);
+    pthread_mutex_unlock(&file_mem->lock);
+    return sent;
+}
+
 // Frees the memory previously allocated to the cell whose reference is
-// file_cell in the specified file.
+// file_cell in the specified file. The release becomes durable with the next
+// write_index.
 void free_cell(FileMem file_mem, FileCell file_cell) {
-    fseek(file_mem->file, virtual_to_real(file_mem, file_cell), SEEK_SET);
-    fwrite(&file_mem->control_info.free_cells, FILE_CELL_SIZE, 1, file_mem->file);
-    file_mem->control_info.free_cells = file_cell;
-    write_control_info(file_mem);
+    check_writable(file_mem, "freeing a cell");
+    pthread_mutex_lock(&file_mem->lock);
+    trace(file_mem, TRACE_FREE_CELL, file_cell);
+    if (file_mem->mode == FILE_MEM_SHARED_WRITER) {
+        retire_cells(file_mem, &file_cell, 1, file_mem->sequence + 1);
+    } else {
+        push_free_cell(file_mem, file_cell);
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+}
+
+// Frees the memory previously allocated to the count cells whose references
+// are in file_cells, which are linked to each other, in order, and spliced onto
+// the free list at once. The release becomes durable with the next
+// write_index.
+void free_cells(FileMem file_mem, const FileCell *file_cells, int count) {
+    if (count <= 0) {
+        return;
+    }
+    check_writable(file_mem, "freeing cells");
+    pthread_mutex_lock(&file_mem->lock);
+    if (file_mem->mode == FILE_MEM_SHARED_WRITER) {
+        for (int i = 0; i < count; i++) {
+            trace(file_mem, TRACE_FREE_CELL, file_cells[i]);
+        }
+        retire_cells(file_mem, file_cells, count, file_mem->sequence + 1);
+        pthread_mutex_unlock(&file_mem->lock);
+        return;
+    }
+    unsigned char cell[file_mem->control_info.cell_size];
+    memset(cell, 0, file_mem->control_info.cell_size);
+    for (int i = 0; i < count; i++) {
+        FileCell next = i + 1 < count ? file_cells[i + 1] : file_mem->control_info.free_cells;
+        trace(file_mem, TRACE_FREE_CELL, file_cells[i]);
+        memcpy(cell, &next, FILE_CELL_SIZE);
+        store_cell(file_mem, file_cells[i], cell);
+    }
+    file_mem->control_info.free_cells = file_cells[0];
+    file_mem->header_dirty = true;
+    pthread_mutex_unlock(&file_mem->lock);
+}
+
+// Returns the first cell of the free list of the specified file, or NULL_CELL
+// if there are no free cells.
+FileCell file_mem_free_list(FileMem file_mem) {
+    pthread_mutex_lock(&file_mem->lock);
+    FileCell free_cells = file_mem->control_info.free_cells;
+    pthread_mutex_unlock(&file_mem->lock);
+    return free_cells;
+}
+
+// Returns the layout and allocation of the specified file. Counting the free
+// cells reads every cell of the free list.
+FileMemInfo file_mem_info(FileMem file_mem) {
+    FileMemInfo info;
+    pthread_mutex_lock(&file_mem->lock);
+    info.index_size = file_mem->control_info.index_size;
+    info.cell_size = file_mem->control_info.cell_size;
+    info.num_cells = file_mem->control_info.num_cells;
+    info.file_size = virtual_to_real(file_mem, info.num_cells + 1);
+    info.free_cells = 0;
+    info.retired_cells = (int)file_mem->retired_count;
+    FileCell file_cell = file_mem->control_info.free_cells;
+    while (file_cell > 0 && file_cell <= info.num_cells && info.free_cells <= info.num_cells) {
+        info.free_cells++;
+        file_cell = load_link(file_mem, file_cell);
+    }
+    if (info.free_cells > info.num_cells) {
+        info.free_cells = -1;
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return info;
+}
+
+// Enables a write-back cache of capacity cells in the specified file. Returns
+// false if the file already has a cache or it could not be allocated.
+bool file_mem_enable_cache(FileMem file_mem, size_t capacity) {
+    pthread_mutex_lock(&file_mem->lock);
+    bool enabled = false;
+    if (file_mem->cache == NULL) {
+        file_mem->cache = cell_cache_create(capacity, file_mem->control_info.cell_size, write_back_cell, file_mem);
+        enabled = file_mem->cache != NULL;
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return enabled;
+}
+
+// Starts a background thread that writes the dirty cells of the cache of the
+// specified file back, as configured by config. Returns false if the file has
+// no cache, the flusher is already running or the thread could not be created.
+bool file_mem_start_flusher(FileMem file_mem, const FlusherConfig *config) {
+    pthread_mutex_lock(&file_mem->lock);
+    bool started = false;
+    if (file_mem->cache != NULL && !file_mem->flusher_running) {
+        file_mem->flusher_config = *config;
+        if (file_mem->flusher_config.interval_ms == 0) {
+            file_mem->flusher_config.interval_ms = 1;
+        }
+        file_mem->flusher_stopping = false;
+        started = pthread_create(&file_mem->flusher, NULL, flusher_main, file_mem) == 0;
+        file_mem->flusher_running = started;
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return started;
+}
+
+// Stops the background flusher of the specified file, if it is running.
+void file_mem_stop_flusher(FileMem file_mem) {
+    pthread_mutex_lock(&file_mem->lock);
+    bool running = file_mem->flusher_running;
+    file_mem->flusher_stopping = true;
+    pthread_cond_signal(&file_mem->wakeup);
+    pthread_mutex_unlock(&file_mem->lock);
+    if (running) {
+        pthread_join(file_mem->flusher, NULL);
+        file_mem->flusher_running = false;
+    }
+}
+
+// Writes every dirty cell and the latest commit of the specified file to the
+// file.
+void file_mem_flush(FileMem file_mem) {
+    pthread_mutex_lock(&file_mem->lock);
+    flush_all(file_mem);
+    pthread_mutex_unlock(&file_mem->lock);
+}
+
+// Returns the number of dirty cells held in the cache of the specified file.
+size_t file_mem_dirty_cells(FileMem file_mem) {
+    pthread_mutex_lock(&file_mem->lock);
+    size_t dirty = file_mem->cache == NULL ? 0 : cell_cache_dirty(file_mem->cache);
+    pthread_mutex_unlock(&file_mem->lock);
+    return dirty;
+}
+
+// Reloads the latest commit of a file opened as a shared reader, and returns
+// true if it is newer than the one previously loaded.
+bool file_mem_refresh(FileMem file_mem) {
+    unsigned char slot[SUPERBLOCK_SIZE];
+    _SuperblockHeader header;
+    pthread_mutex_lock(&file_mem->lock);
+    bool pinned = file_mem->mode == FILE_MEM_SHARED_READER && pin_newest_slot(file_mem, slot, &header);
+    bool refreshed = pinned && header.sequence > file_mem->sequence &&
+                     header.control_info.index_size == file_mem->control_info.index_size;
+    if (pinned && header.sequence != file_mem->sequence) {
+        // Release whichever of the two commits the reader does not keep.
+        lock_sequence(file_mem, F_UNLCK, refreshed ? file_mem->sequence : header.sequence);
+    }
+    if (refreshed) {
+        file_mem->control_info = header.control_info;
+        file_mem->sequence = header.sequence;
+        memcpy(file_mem->index, slot + SUPERBLOCK_HEADER_SIZE, file_mem->control_info.index_size);
+        if (file_mem->cache != NULL) {
+            // Cells may have been rewritten by the writer.
+            size_t capacity = cell_cache_capacity(file_mem->cache);
+            cell_cache_destroy(file_mem->cache);
+            file_mem->cache = cell_cache_create(capacity, file_mem->control_info.cell_size, write_back_cell, file_mem);
+        }
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return refreshed;
+}
+
+// Creates a file that only exists in memory, with the same layout and
+// allocation as create_file. Its contents can be saved with file_mem_dump.
+FileMem create_memory_file(int index_size, int cell_size) {
+    FileMemOptions options = {.mode = FILE_MEM_PRIVATE, .backend = &memory_backend};
+    return create_file_with_options(NULL, index_size, cell_size, &options);
+}
+
+// Writes the contents of the specified file, including its cached cells and
+// latest commit, to a new file whose name is the string pointed to by
+// file_name, which can then be opened with open_file. On Linux, the new file
+// shares the blocks of the file when the file system supports reflinks, and is
+// otherwise copied within the kernel when it can be. Returns false if that file already
+// exists or could not be written, in which case it is removed.
+bool file_mem_dump(FileMem file_mem, const char *file_name) {
+    int fd = open(file_name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    pthread_mutex_lock(&file_mem->lock);
+    flush_all(file_mem);
+    long size = virtual_to_real(file_mem, file_mem->control_info.num_cells + 1);
+    bool dumped = false;
+#ifdef __linux__
+    int source = file_mem->backend->fd(file_mem->storage);
+    // The file may be longer than its cells, as with the mmap backend.
+    dumped = source >= 0 && ioctl(fd, FICLONE, source) == 0 && ftruncate(fd, size) == 0;
+#endif
+    if (dumped) {
+        storage_copied(file_mem, 0, size);
+    } else {
+        dumped = ftruncate(fd, 0) == 0 && storage_send_all(file_mem, 0, size, fd);
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    dumped = close(fd) == 0 && dumped;
+    if (!dumped) {
+        unlink(file_name);
+    }
+    return dumped;
+}
+
+// Returns the counters of the operations done on the specified file.
+FileMemStats file_mem_stats(FileMem file_mem) {
+    pthread_mutex_lock(&file_mem->lock);
+    FileMemStats stats = file_mem->stats;
+    pthread_mutex_unlock(&file_mem->lock);
+    return stats;
+}
+
+// Resets the counters of the operations done on the specified file.
+void file_mem_reset_stats(FileMem file_mem) {
+    pthread_mutex_lock(&file_mem->lock);
+    memset(&file_mem->stats, 0, sizeof(FileMemStats));
+    pthread_mutex_unlock(&file_mem->lock);
+}
+
+// Starts recording every access to the specified file in a trace file whose
+// name is the string pointed to by trace_file_name. Returns false if the file
+// is already traced or the trace could not be created.
+bool file_mem_start_trace(FileMem file_mem, const char *trace_file_name) {
+    pthread_mutex_lock(&file_mem->lock);
+    bool started = false;
+    if (file_mem->trace == NULL) {
+        file_mem->trace = trace_writer_open(trace_file_name, file_mem->control_info.index_size,
+                                            file_mem->control_info.cell_size);
+        started = file_mem->trace != NULL;
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return started;
+}
+
+// Stops recording the accesses to the specified file, and completes its
+// trace. Returns false if the trace could not be completely written.
+bool file_mem_stop_trace(FileMem file_mem) {
+    pthread_mutex_lock(&file_mem->lock);
+    bool written = true;
+    if (file_mem->trace != NULL) {
+        written = trace_writer_close(file_mem->trace);
+        file_mem->trace = NULL;
+    }
+    pthread_mutex_unlock(&file_mem->lock);
+    return written;
 }
@@ -1,22 +1,134 @@
 #ifndef MEMORY_MANAGER_H
 #define MEMORY_MANAGER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "storage_backend.h"
+
 typedef int FileCell;
 #define NULL_CELL 0
 
+// Size of each of the two superblock slots at the start of the file. A
+// superblock holds the control info and the index, and commits alternate
+// between the slots.
+#define SUPERBLOCK_SIZE 512
+
 typedef struct _FileMem *FileMem;
 
+// How a file is shared with other processes.
+typedef enum {
+    // The file is not coordinated with other processes.
+    FILE_MEM_PRIVATE,
+    // The only process allowed to change the file, enforced by an advisory
+    // lock. Every commit is made visible to readers as soon as it is written.
+    // Freed cells are not reused, nor written to, while a reader holds a
+    // commit from before they were freed. Those still retired when the file
+    // is closed are listed in the file, and taken back by the next writer.
+    FILE_MEM_SHARED_WRITER,
+    // A read-only snapshot of the latest commit when the file was opened or
+    // last refreshed. The reader holds a lock on a byte that stands for that
+    // commit, which tells the writer which freed cells it may still reach, but
+    // the writer never waits for it. The cells the snapshot reaches are never
+    // reused under it, so it stays consistent as long as the writer changes
+    // cells by copying them rather than in place, as versioned lists do.
+    // Outside Linux, the writer only sees readers in other processes.
+    FILE_MEM_SHARED_READER
+} FileMemMode;
+
+// Options for creating and opening files.
+typedef struct {
+    FileMemMode mode;
+    // Storage of the file, or NULL for stdio_backend.
+    const StorageBackend *backend;
+} FileMemOptions;
+
+// Configuration of the background flusher of a file with a cache.
+typedef struct {
+    // Fraction of the cache that may hold dirty cells before the flusher is
+    // woken up to write them back regardless of their age.
+    double dirty_ratio;
+    // Dirty cells older than this are written back by the flusher.
+    unsigned max_age_ms;
+    // Interval between the flusher passes when it is not woken up.
+    unsigned interval_ms;
+} FlusherConfig;
+
+// Counters of the operations done on a file since it was opened or its
+// counters were last reset.
+typedef struct {
+    // Calls to read_cell and write_cell.
+    uint64_t cell_reads;
+    uint64_t cell_writes;
+    // Cell reads and writes that reached the storage, which differ from the
+    // calls when the file has a cache.
+    uint64_t storage_reads;
+    uint64_t storage_writes;
+    // Cell writes of the flusher that failed. The cells stay dirty, and are
+    // written back again by its next pass.
+    uint64_t failed_writes;
+    // Superblocks, holding the control info and the index, written to storage.
+    uint64_t control_info_writes;
+    // Calls to write_index that committed a change.
+    uint64_t index_writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    // Cells allocated from the free list and by extending the file.
+    uint64_t free_list_pops;
+    uint64_t file_extensions;
+} FileMemStats;
+
+// Layout and allocation of a file.
+typedef struct {
+    int index_size;
+    int cell_size;
+    // Cells in the file, allocated or free.
+    int num_cells;
+    // Cells in the free list, or -1 if the free list is longer than the
+    // file, which only a damaged file can be.
+    int free_cells;
+    // Cells freed by a shared writer that are not in the free list yet,
+    // because readers may still reach them.
+    int retired_cells;
+    // Size of the file in bytes, including both superblock slots.
+    long file_size;
+} FileMemInfo;
+
 // Creates and opens a file whose name is the string pointed to by fileName, if
 // the file does not exist, otherwise returns NULL. The index has index_size
-// bytes, and cells have cell_size bytes. Pre-condition: theCellSize >= 4.
+// bytes, and cells have cell_size bytes. Pre-condition: theCellSize >= 4, and
+// the index fits in a superblock slot.
 FileMem create_file(const char *file_name, int index_size, int cell_size);
 
 // Opens the file whose name is the string pointed to by file_name, if the file
-// exists, otherwise, returns NULL.
+// exists and holds a valid superblock, otherwise, returns NULL. The newest
+// valid superblock slot is loaded. Files written before superblocks were
+// introduced have none, and are not opened.
 FileMem open_file(const char *file_name);
 
+// Creates and opens a file like create_file, configured by options, which may
+// be NULL. Returns NULL if the file could not be created in the requested mode.
+FileMem create_file_with_options(const char *file_name, int index_size, int cell_size,
+                                 const FileMemOptions *options);
+
+// Opens a file like open_file, configured by options, which may be NULL.
+// Returns NULL if the file could not be opened in the requested mode.
+FileMem open_file_with_options(const char *file_name, const FileMemOptions *options);
+
+// Creates a file that only exists in memory, with the same layout and
+// allocation as create_file. Its contents can be saved with file_mem_dump.
+FileMem create_memory_file(int index_size, int cell_size);
+
+// Writes the contents of the specified file, including its cached cells and
+// latest commit, to a new file whose name is the string pointed to by
+// file_name, which can then be opened with open_file. On Linux, the new file
+// shares the blocks of the file when the file system supports reflinks, and is
+// otherwise copied within the kernel when it can be. Returns false if that file already
+// exists or could not be written, in which case it is removed.
+bool file_mem_dump(FileMem file_mem, const char *file_name);
+
 // Closes the specified file.
 void close_file(FileMem file_mem);
 
@@ -25,7 +137,7 @@ void close_file(FileMem file_mem);
 void read_index(FileMem file_mem, void *idx);
 
 // Writes the index to the specified file, obtaining it from the location given
-// by index.
+// by index. This commits the index together with the control info.
 void write_index(FileMem file_mem, void *idx);
 
 // Reads from the specified file the cell whose reference is file_cell, storing
@@ -37,11 +149,99 @@ void read_cell(FileMem file_mem, FileCell file_cell, void *cell);
 void write_cell(FileMem file_mem, FileCell file_cell, void *cell);
 
 // Allocates memory to a new cell in the specified file, and returns a reference
-// to it.
+// to it. The allocation becomes durable with the next write_index.
 FileCell new_cell(FileMem file_mem);
 
+// Allocates count consecutive new cells at the end of the specified file,
+// bypassing the free list, and returns a reference to the first. The
+// allocation becomes durable with the next write_index.
+FileCell new_cells(FileMem file_mem, int count);
+
+// Reads from the specified file up to count consecutive cells, starting with
+// the one whose reference is file_cell, storing them at the location given by
+// cells, and returns how many were read: cells past the last one of the file
+// are not. Without a cache, they are read with a single read.
+int read_cells(FileMem file_mem, FileCell file_cell, int count, void *cells);
+
+// Writes to the specified file count consecutive cells, starting with the
+// one whose reference is file_cell, obtaining them from the location given by
+// cells. Without a cache, they are written with a single write.
+void write_cells(FileMem file_mem, FileCell file_cell, int count, const void *cells);
+
+// Writes count consecutive cells of the specified file, starting with the one
+// whose reference is file_cell, to the file descriptor fd, after writing the
+// dirty cells back. The kernel copies them from the file when the backend has
+// a file descriptor; otherwise, or if it cannot, they are read into a buffer
+// and written. Returns false if they could not be completely written.
+bool file_mem_send_cells(FileMem file_mem, FileCell file_cell, int count, int fd);
+
 // Frees the memory previously allocated to the cell whose reference is
-// file_cell in the specified file.
+// file_cell in the specified file. The release becomes durable with the next
+// write_index.
 void free_cell(FileMem file_mem, FileCell cell);
 
+// Reads from the specified file the cell reference stored in the cell whose
+// reference is file_cell, and returns it. For a free cell, that is the next
+// cell in the free list.
+FileCell get_next_file_cell(FileMem file_mem, FileCell file_cell);
+
+// Frees the memory previously allocated to the count cells whose references
+// are in file_cells, which are linked to each other, in order, and spliced onto
+// the free list at once. The release becomes durable with the next
+// write_index.
+void free_cells(FileMem file_mem, const FileCell *file_cells, int count);
+
+// Returns the first cell of the free list of the specified file, or NULL_CELL
+// if there are no free cells.
+FileCell file_mem_free_list(FileMem file_mem);
+
+// Returns the layout and allocation of the specified file. Counting the free
+// cells reads every cell of the free list.
+FileMemInfo file_mem_info(FileMem file_mem);
+
+// Enables a write-back cache of capacity cells in the specified file. Written
+// cells are kept in memory until they are evicted, written back by the flusher,
+// or the file is flushed or closed. Returns false if the file already has a
+// cache or it could not be allocated.
+bool file_mem_enable_cache(FileMem file_mem, size_t capacity);
+
+// Starts a background thread that writes the dirty cells of the cache of the
+// specified file back, as configured by config. Returns false if the file has
+// no cache, the flusher is already running or the thread could not be created.
+bool file_mem_start_flusher(FileMem file_mem, const FlusherConfig *config);
+
+// Stops the background flusher of the specified file, if it is running.
+void file_mem_stop_flusher(FileMem file_mem);
+
+// Writes every dirty cell and the latest commit of the specified file to the
+// file.
+void file_mem_flush(FileMem file_mem);
+
+// Returns the number of dirty cells held in the cache of the specified file.
+size_t file_mem_dirty_cells(FileMem file_mem);
+
+// Reloads the latest commit of a file opened as a shared reader, and returns
+// true if it is newer than the one previously loaded.
+bool file_mem_refresh(FileMem file_mem);
+
+// Returns the counters of the operations done on the specified file.
+FileMemStats file_mem_stats(FileMem file_mem);
+
+// Resets the counters of the operations done on the specified file.
+void file_mem_reset_stats(FileMem file_mem);
+
+// Starts recording every access to the specified file, with its time, in a
+// compact binary trace file whose name is the string pointed to by
+// trace_file_name, which can be replayed by the replay tool. Returns false if
+// the file is already traced or the trace could not be created.
+bool file_mem_start_trace(FileMem file_mem, const char *trace_file_name);
+
+// Stops recording the accesses to the specified file, and completes its
+// trace. Returns false if the trace could not be completely written.
+bool file_mem_stop_trace(FileMem file_mem);
+
+// Stores in the last bytes of slot, a superblock slot of SUPERBLOCK_SIZE bytes,
+// the checksum of the bytes before them, which completes the slot.
+void file_mem_seal_superblock(void *slot);
+
 #endif
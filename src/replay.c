@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency_histogram.h"
+#include "memory_manager.h"
+#include "trace.h"
+
+#define MAX_SIZES 16
+
+// Cells of a simulated cache, linked from the next to be evicted to the last.
+typedef struct {
+    size_t num_cells;
+    bool *cached;
+    bool *dirty;
+    FileCell *prev;
+    FileCell *next;
+    FileCell first;
+    FileCell last;
+} _SimulatedCache;
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s TRACE [--backend NAME] [--cache N] [--file NAME] [--timed]\n"
+            "       %s TRACE --simulate lru|fifo --sizes N,...\n",
+            program, program);
+    exit(1);
+}
+
+// Makes room in the arrays of the cache for the cell whose reference is cell.
+static void reserve(_SimulatedCache *cache, FileCell cell) {
+    if ((size_t)cell < cache->num_cells) {
+        return;
+    }
+    size_t num_cells = cache->num_cells == 0 ? 1024 : cache->num_cells;
+    while (num_cells <= (size_t)cell) {
+        num_cells *= 2;
+    }
+    cache->cached = realloc(cache->cached, num_cells * sizeof(bool));
+    cache->dirty = realloc(cache->dirty, num_cells * sizeof(bool));
+    cache->prev = realloc(cache->prev, num_cells * sizeof(FileCell));
+    cache->next = realloc(cache->next, num_cells * sizeof(FileCell));
+    memset(cache->cached + cache->num_cells, 0, (num_cells - cache->num_cells) * sizeof(bool));
+    memset(cache->dirty + cache->num_cells, 0, (num_cells - cache->num_cells) * sizeof(bool));
+    cache->num_cells = num_cells;
+}
+
+static void unlink_cell(_SimulatedCache *cache, FileCell cell) {
+    if (cache->prev[cell] != NULL_CELL) {
+        cache->next[cache->prev[cell]] = cache->next[cell];
+    } else {
+        cache->first = cache->next[cell];
+    }
+    if (cache->next[cell] != NULL_CELL) {
+        cache->prev[cache->next[cell]] = cache->prev[cell];
+    } else {
+        cache->last = cache->prev[cell];
+    }
+}
+
+static void append_cell(_SimulatedCache *cache, FileCell cell) {
+    cache->prev[cell] = cache->last;
+    cache->next[cell] = NULL_CELL;
+    if (cache->last != NULL_CELL) {
+        cache->next[cache->last] = cell;
+    } else {
+        cache->first = cell;
+    }
+    cache->last = cell;
+}
+
+// Simulates a write-back cache of capacity cells on the cell accesses of the
+// trace, evicting the least recently used cell, or the first cached if fifo
+// is true, and prints how many accesses hit and how many cells were written
+// back.
+static bool simulate(const char *trace_file_name, size_t capacity, bool fifo) {
+    TraceReader reader = trace_reader_open(trace_file_name);
+    if (reader == NULL) {
+        return false;
+    }
+    _SimulatedCache cache = {0, NULL, NULL, NULL, NULL, NULL_CELL, NULL_CELL};
+    size_t used = 0;
+    unsigned long long hits = 0, misses = 0, write_backs = 0;
+    TraceRecord record;
+    while (trace_read(reader, &record)) {
+        if (record.op != TRACE_READ_CELL && record.op != TRACE_WRITE_CELL && record.op != TRACE_FREE_CELL) {
+            continue;
+        }
+        FileCell cell = record.cell;
+        reserve(&cache, cell);
+        if (cache.cached[cell]) {
+            hits++;
+            if (!fifo) {
+                unlink_cell(&cache, cell);
+                append_cell(&cache, cell);
+            }
+        } else {
+            misses++;
+            if (used == capacity) {
+                FileCell victim = cache.first;
+                unlink_cell(&cache, victim);
+                cache.cached[victim] = false;
+                write_backs += cache.dirty[victim];
+                cache.dirty[victim] = false;
+            } else {
+                used++;
+            }
+            cache.cached[cell] = true;
+            append_cell(&cache, cell);
+        }
+        if (record.op != TRACE_READ_CELL) {
+            cache.dirty[cell] = true;
+        }
+    }
+    for (FileCell cell = cache.first; cell != NULL_CELL; cell = cache.next[cell]) {
+        write_backs += cache.dirty[cell];
+    }
+    printf("%s,%zu,%llu,%llu,%.4f,%llu\n", fifo ? "fifo" : "lru", capacity, hits, misses,
+           hits + misses == 0 ? 0 : (double)hits / (hits + misses), write_backs);
+    free(cache.cached);
+    free(cache.dirty);
+    free(cache.prev);
+    free(cache.next);
+    trace_reader_close(reader);
+    return true;
+}
+
+// Waits until time_ns nanoseconds after start.
+static void wait_until(uint64_t start, uint64_t time_ns) {
+    uint64_t now = latency_now_ns();
+    if (start + time_ns > now) {
+        uint64_t delay = start + time_ns - now;
+        struct timespec duration = {(time_t)(delay / 1000000000u), (long)(delay % 1000000000u)};
+        nanosleep(&duration, NULL);
+    }
+}
+
+// Replays the accesses of the trace against a new file, and prints the time
+// taken by each kind of access and the I/O counters of the file. The cells
+// allocated by the replay are mapped to the traced ones, and cell contents,
+// which are not traced, are zeros.
+static bool replay(const char *trace_file_name, const char *file_name, const FileMemOptions *options, size_t cache,
+                   bool timed) {
+    TraceReader reader = trace_reader_open(trace_file_name);
+    if (reader == NULL) {
+        fprintf(stderr, "%s is not a trace.\n", trace_file_name);
+        return false;
+    }
+    remove(file_name);
+    FileMem file_mem = create_file_with_options(options->backend == &memory_backend ? NULL : file_name,
+                                                trace_index_size(reader), trace_cell_size(reader), options);
+    if (file_mem == NULL || (cache > 0 && !file_mem_enable_cache(file_mem, cache))) {
+        fprintf(stderr, "Could not create %s.\n", file_name);
+        trace_reader_close(reader);
+        return false;
+    }
+    LatencyHistogram latency[TRACE_OP_COUNT];
+    for (int op = 0; op < TRACE_OP_COUNT; op++) {
+        latency[op] = latency_histogram_create();
+    }
+    unsigned char *cell = calloc(1, trace_cell_size(reader));
+    unsigned char *index = calloc(1, trace_index_size(reader) + sizeof(uint64_t));
+    uint64_t commits = 0;
+    FileCell *cells = NULL;
+    size_t num_cells = 0;
+    file_mem_reset_stats(file_mem);
+
+    TraceRecord record;
+    uint64_t start = latency_now_ns();
+    while (trace_read(reader, &record)) {
+        if (timed) {
+            wait_until(start, record.time_ns);
+        }
+        if ((size_t)record.cell >= num_cells) {
+            size_t grown = num_cells == 0 ? 1024 : num_cells;
+            while (grown <= (size_t)record.cell) {
+                grown *= 2;
+            }
+            cells = realloc(cells, grown * sizeof(FileCell));
+            for (size_t i = num_cells; i < grown; i++) {
+                cells[i] = (FileCell)i;
+            }
+            num_cells = grown;
+        }
+        FileCell mapped = cells[record.cell];
+        uint64_t op_start = latency_now_ns();
+        switch (record.op) {
+        case TRACE_READ_CELL:
+            read_cell(file_mem, mapped, cell);
+            break;
+        case TRACE_WRITE_CELL:
+            write_cell(file_mem, mapped, cell);
+            break;
+        case TRACE_NEW_CELL:
+            cells[record.cell] = new_cell(file_mem);
+            break;
+        case TRACE_FREE_CELL:
+            free_cell(file_mem, mapped);
+            break;
+        case TRACE_READ_INDEX:
+            read_index(file_mem, index);
+            break;
+        case TRACE_WRITE_INDEX:
+            // Changes the index, so that every traced commit is made.
+            commits++;
+            memcpy(index, &commits, trace_index_size(reader) < 8 ? (size_t)trace_index_size(reader) : 8);
+            write_index(file_mem, index);
+            break;
+        default:
+            // Superblocks are written as a consequence of the other accesses.
+            continue;
+        }
+        latency_histogram_record(latency[record.op], latency_now_ns() - op_start);
+    }
+    file_mem_flush(file_mem);
+    uint64_t elapsed = latency_now_ns() - start;
+    FileMemStats stats = file_mem_stats(file_mem);
+    printf("seconds=%.3f\n", elapsed / 1e9);
+    for (int op = 0; op < TRACE_OP_COUNT; op++) {
+        if (latency_histogram_count(latency[op]) > 0) {
+            latency_histogram_print(latency[op], stdout, trace_op_name(op));
+        }
+        latency_histogram_destroy(latency[op]);
+    }
+    printf("storage_reads=%llu storage_writes=%llu control_info_writes=%llu bytes_read=%llu bytes_written=%llu\n",
+           (unsigned long long)stats.storage_reads, (unsigned long long)stats.storage_writes,
+           (unsigned long long)stats.control_info_writes, (unsigned long long)stats.bytes_read,
+           (unsigned long long)stats.bytes_written);
+    close_file(file_mem);
+    remove(file_name);
+    free(cells);
+    free(cell);
+    free(index);
+    trace_reader_close(reader);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    FileMemOptions options = {.mode = FILE_MEM_PRIVATE, .backend = &stdio_backend};
+    const char *file_name = "replay.mem";
+    const char *policy = NULL;
+    char *sizes = NULL;
+    size_t cache = 0;
+    bool timed = false;
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--timed") == 0) {
+            timed = true;
+        } else if (i + 1 == argc) {
+            usage(argv[0]);
+        } else if (strcmp(argv[i], "--backend") == 0) {
+            options.backend = find_storage_backend(argv[++i]);
+            if (options.backend == NULL) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            cache = (size_t)strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--file") == 0) {
+            file_name = argv[++i];
+        } else if (strcmp(argv[i], "--simulate") == 0) {
+            policy = argv[++i];
+        } else if (strcmp(argv[i], "--sizes") == 0) {
+            sizes = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (policy == NULL) {
+        return replay(argv[1], file_name, &options, cache, timed) ? 0 : 1;
+    }
+    if (sizes == NULL || (strcmp(policy, "lru") != 0 && strcmp(policy, "fifo") != 0)) {
+        usage(argv[0]);
+    }
+    printf("policy,capacity,hits,misses,hit_ratio,write_backs\n");
+    for (char *size = strtok(sizes, ","); size != NULL; size = strtok(NULL, ",")) {
+        if (!simulate(argv[1], (size_t)strtod(size, NULL), strcmp(policy, "fifo") == 0)) {
+            fprintf(stderr, "%s is not a trace.\n", argv[1]);
+            return 1;
+        }
+    }
+    return 0;
+}
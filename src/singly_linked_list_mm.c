@@ -1,7 +1,12 @@
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "id_index.h"
 #include "list_mm.h"
 #include "memory_manager.h"
 
@@ -11,94 +16,557 @@ struct Node_ {
 };
 typedef struct Node_ Node_, *Node;
 
+// When the SEQUENTIAL flag is set, the element at each position p is stored
+// in cell p + 1, so the list can be copied as a range of cells. The flag is
+// kept while elements are appended in the next cell, and cleared by any other
+// change that moves them. The id index of the list, if it has one, is a table
+// kept in cells of the same file. Files created before the flags or the id
+// index existed have a shorter index, which leaves them cleared.
 typedef struct {
     FileCell head;
     FileCell tail;
     size_t size;
+    uint32_t flags;
+    IdIndex ids;
 } ListMMIndex;
 
+#define INDEX_SEQUENTIAL 1u
+
+typedef struct {
+    FileCell cell;
+    uint64_t epoch;
+} RetiredCell;
+
+// Number of elements copied at a time by list_compact.
+#define COMPACT_BATCH 4096
+
+// A snapshot starts with the magic number, the version and the size of an
+// element, as 32-bit words, and the number of elements, as a 64-bit word.
+#define SNAPSHOT_MAGIC 0x534d4d4cu
+#define SNAPSHOT_VERSION 1u
+#define SNAPSHOT_HEADER_SIZE 20
+#define SNAPSHOT_BUFFER_SIZE (64 * 1024)
+
+// Number of cells sent at a time when a list stored in order is exported.
+#define SEND_BATCH (1 << 20)
+
+// Largest number of cells freed at once by release_cells.
+#define FREE_BATCH (1 << 20)
+
+// Largest number of cells read at once by a ListReader.
+#define READAHEAD_MAX 64
+
+// Largest number of cells written at once by a ListWriter.
+#define WRITE_BATCH 64
+
+// When the list is thread-safe, operations that only read the list share the
+// lock, and operations that change it hold the lock exclusively. Access to the
+// file itself is serialized by the FileMem.
+//
+// When the list is versioned, changes never overwrite a node that a pinned
+// version can reach: the nodes are copied, and the originals are retired with
+// the epoch of the commit that unlinked them. A retired node is freed once
+// every pinned version is at least as recent as that epoch. Pinned versions
+// and the published index are guarded by versions_lock.
 struct ListMM_ {
     FileMem file_mem;
     ListMMIndex index;
+    bool thread_safe;
+    pthread_rwlock_t lock;
+    bool versioned;
+    // Set when the file is shared with readers in other processes, which
+    // requires the list to be versioned.
+    bool shared;
+    uint64_t epoch;
+    ListMMIndex published;
+    ListVersion versions;
+    pthread_mutex_t versions_lock;
+    RetiredCell* retired;
+    size_t num_retired;
+    size_t retired_capacity;
+    LatencyHistogram* latency;
+};
+
+struct ListVersion_ {
+    ListMM list;
+    ListMMIndex index;
+    uint64_t epoch;
+    ListVersion prev;
+    ListVersion next;
 };
 
+// Allocates a list for the specified file, or returns NULL if there is none.
+static ListMM new_list(FileMem file_mem) {
+    if (file_mem == NULL) {
+        return NULL;
+    }
+    ListMM list = malloc(sizeof(struct ListMM_));
+    list->file_mem = file_mem;
+    list->thread_safe = false;
+    pthread_rwlock_init(&list->lock, NULL);
+    list->versioned = false;
+    list->shared = false;
+    list->epoch = 0;
+    list->versions = NULL;
+    pthread_mutex_init(&list->versions_lock, NULL);
+    list->retired = NULL;
+    list->num_retired = 0;
+    list->retired_capacity = 0;
+    list->latency = NULL;
+    return list;
+}
+
+// Makes the list versioned if options open its file as a shared writer, so
+// that no change rewrites a node that a reader in another process can reach.
+static void share(ListMM list, const FileMemOptions* options) {
+    if (options != NULL && options->mode == FILE_MEM_SHARED_WRITER) {
+        list->shared = true;
+        list->versioned = true;
+        list->published = list->index;
+    }
+}
+
+// Releases the memory of a list whose file is closed.
+static void free_list(ListMM list) {
+    pthread_rwlock_destroy(&list->lock);
+    pthread_mutex_destroy(&list->versions_lock);
+    free(list->retired);
+    if (list->latency != NULL) {
+        for (int op = 0; op < LIST_OP_COUNT; op++) {
+            latency_histogram_destroy(list->latency[op]);
+        }
+        free(list->latency);
+    }
+    free(list);
+}
+
+// Frees the retired nodes that were unlinked by a commit no later than epoch.
+static void reclaim(ListMM list, uint64_t epoch) {
+    size_t reclaimed = 0;
+    while (reclaimed < list->num_retired && list->retired[reclaimed].epoch <= epoch) {
+        free_cell(list->file_mem, list->retired[reclaimed].cell);
+        reclaimed++;
+    }
+    if (reclaimed > 0) {
+        list->num_retired -= reclaimed;
+        memmove(list->retired, list->retired + reclaimed, list->num_retired * sizeof(RetiredCell));
+    }
+}
+
+// Releases the node stored at cell, which the current change unlinks from the
+// list. In a versioned list, the node is kept until no pinned version can
+// reach it.
+static void release_cell(ListMM list, FileCell cell) {
+    if (!list->versioned) {
+        free_cell(list->file_mem, cell);
+        return;
+    }
+    if (list->num_retired == list->retired_capacity) {
+        list->retired_capacity = list->retired_capacity == 0 ? 64 : 2 * list->retired_capacity;
+        list->retired = realloc(list->retired, list->retired_capacity * sizeof(RetiredCell));
+    }
+    list->retired[list->num_retired].cell = cell;
+    list->retired[list->num_retired].epoch = list->epoch + 1;
+    list->num_retired++;
+}
+
+// Releases the count nodes stored at cells, which the current change unlinks
+// from the list. Unless the list is versioned, they are spliced onto the free
+// list together.
+static void release_cells(ListMM list, const FileCell* cells, size_t count) {
+    if (list->versioned) {
+        for (size_t i = 0; i < count; i++) {
+            release_cell(list, cells[i]);
+        }
+        return;
+    }
+    for (size_t done = 0; done < count; done += FREE_BATCH) {
+        free_cells(list->file_mem, cells + done, count - done < FREE_BATCH ? (int)(count - done) : FREE_BATCH);
+    }
+}
+
+// Returns true if the list has an id index.
+static bool has_id_index(ListMM list) {
+    return list->index.ids.buckets != NULL_CELL;
+}
+
+// Maps the id of element, which is stored at cell, in the id index of the
+// list, if it has one.
+static void index_id(ListMM list, const Element* element, FileCell cell) {
+    if (has_id_index(list)) {
+        id_index_add(list->file_mem, &list->index.ids, element->id, cell);
+    }
+}
+
+// Removes the mapping of the id of element, which was stored at cell, from the
+// id index of the list, if it has one.
+static void unindex_id(ListMM list, const Element* element, FileCell cell) {
+    if (has_id_index(list)) {
+        id_index_remove(list->file_mem, &list->index.ids, element->id, cell);
+    }
+}
+
+// Updates the id index of the list, if it has one, for the element stored at
+// cell changing from old_element to element.
+static void reindex_id(ListMM list, const Element* old_element, const Element* element, FileCell cell) {
+    if (has_id_index(list) && strncmp(old_element->id, element->id, ID_SIZE) != 0) {
+        unindex_id(list, old_element, cell);
+        index_id(list, element, cell);
+    }
+}
+
+// Makes the index of the list describe an empty list.
+static void clear_index(ListMMIndex* index) {
+    index->head = NULL_CELL;
+    index->tail = NULL_CELL;
+    index->size = 0;
+    index->flags = INDEX_SEQUENTIAL;
+    memset(&index->ids, 0, sizeof(IdIndex));
+}
+
+// Records that a change may have moved elements of the list out of order.
+static void mark_unordered(ListMM list) {
+    list->index.flags &= ~INDEX_SEQUENTIAL;
+}
+
+// Records that the node stored at cell is about to be appended to the list,
+// which keeps the list in order only if it is the next cell.
+static void note_appended(ListMM list, FileCell cell) {
+    if ((size_t)cell != list->index.size + 1) {
+        mark_unordered(list);
+    }
+}
+
+// Commits the index of the list. In a versioned list, this also publishes the
+// index as the latest version, and frees the retired nodes that no pinned
+// version can reach.
+static void commit(ListMM list) {
+    if (list->index.size == 0) {
+        list->index.flags |= INDEX_SEQUENTIAL;
+    }
+    if (list->versioned) {
+        pthread_mutex_lock(&list->versions_lock);
+        list->epoch++;
+        list->published = list->index;
+        uint64_t oldest = list->epoch;
+        for (ListVersion version = list->versions; version != NULL; version = version->next) {
+            if (version->epoch < oldest) {
+                oldest = version->epoch;
+            }
+        }
+        pthread_mutex_unlock(&list->versions_lock);
+        reclaim(list, oldest);
+    }
+    write_index(list->file_mem, (void*)&(list->index));
+}
+
+// Returns the cell of the node at position - 1, storing the node at prev_node,
+// so that the caller can change its next reference and write it. In a
+// versioned list, the nodes up to that position are first replaced by copies,
+// which pinned versions do not reach. Otherwise, a list stored in order is not
+// walked. Pre-condition: 0 < position < size().
+static FileCell writable_predecessor(ListMM list, size_t position, Node prev_node) {
+    FileCell prev_cell = list->index.head;
+    if (!list->versioned && (list->index.flags & INDEX_SEQUENTIAL)) {
+        prev_cell = (FileCell)position;
+        read_cell(list->file_mem, prev_cell, (void*)prev_node);
+        return prev_cell;
+    }
+    read_cell(list->file_mem, prev_cell, (void*)prev_node);
+    if (!list->versioned) {
+        for (size_t i = 0; i < position - 1; i++) {
+            prev_cell = prev_node->next;
+            read_cell(list->file_mem, prev_cell, (void*)prev_node);
+        }
+        return prev_cell;
+    }
+
+    FileCell copy = new_cell(list->file_mem);
+    list->index.head = copy;
+    for (size_t i = 0; i < position - 1; i++) {
+        FileCell next_copy = new_cell(list->file_mem);
+        FileCell next_cell = prev_node->next;
+        prev_node->next = next_copy;
+        write_cell(list->file_mem, copy, (void*)prev_node);
+        release_cell(list, prev_cell);
+        prev_cell = next_cell;
+        copy = next_copy;
+        read_cell(list->file_mem, prev_cell, (void*)prev_node);
+    }
+    release_cell(list, prev_cell);
+    return copy;
+}
+
+// Reads the nodes of a walk along the list. Each time the walk continues into
+// the cell that follows the last one read, the reader doubles the number of
+// cells it reads at once, up to READAHEAD_MAX; otherwise it reads one cell.
+// Thus a list stored in order is read in batches, and a scattered one a node
+// at a time. Cells read ahead must not be changed during the walk.
+typedef struct {
+    FileMem file_mem;
+    size_t remaining;
+    int window;
+    FileCell first;
+    int count;
+    Node_ nodes[READAHEAD_MAX];
+} ListReader;
+
+// Prepares reader for a walk that reads at most remaining nodes.
+static void reader_init(ListReader* reader, FileMem file_mem, size_t remaining) {
+    reader->file_mem = file_mem;
+    reader->remaining = remaining;
+    reader->window = 1;
+    reader->first = NULL_CELL;
+    reader->count = 0;
+}
+
+// Reads the node stored at cell into node.
+static void reader_read(ListReader* reader, FileCell cell, Node node) {
+    if (reader->count == 0 || cell < reader->first || cell >= reader->first + reader->count) {
+        if (reader->count > 0 && cell == reader->first + reader->count) {
+            reader->window = reader->window * 2 > READAHEAD_MAX ? READAHEAD_MAX : reader->window * 2;
+        } else {
+            reader->window = 1;
+        }
+        int count = reader->remaining < (size_t)reader->window ? (int)reader->remaining : reader->window;
+        reader->first = cell;
+        reader->count = read_cells(reader->file_mem, cell, count < 1 ? 1 : count, (void*)reader->nodes);
+        if (reader->count == 0) {
+            read_cell(reader->file_mem, cell, (void*)node);
+            return;
+        }
+    }
+    *node = reader->nodes[cell - reader->first];
+    if (reader->remaining > 0) {
+        reader->remaining--;
+    }
+}
+
+// Gathers the nodes written by an operation, so that those written to
+// consecutive cells, one after another, are written together.
+typedef struct {
+    FileMem file_mem;
+    FileCell first;
+    int count;
+    Node_ nodes[WRITE_BATCH];
+} ListWriter;
+
+// Prepares writer for an operation on the list file file_mem.
+static void writer_init(ListWriter* writer, FileMem file_mem) {
+    writer->file_mem = file_mem;
+    writer->first = NULL_CELL;
+    writer->count = 0;
+}
+
+// Writes the nodes gathered by writer.
+static void writer_flush(ListWriter* writer) {
+    if (writer->count > 0) {
+        write_cells(writer->file_mem, writer->first, writer->count, (void*)writer->nodes);
+        writer->count = 0;
+    }
+}
+
+// Writes node to cell, once the nodes gathered before it are written.
+static void writer_write(ListWriter* writer, FileCell cell, const Node node) {
+    if (writer->count == WRITE_BATCH || (writer->count > 0 && cell != writer->first + writer->count)) {
+        writer_flush(writer);
+    }
+    if (writer->count == 0) {
+        writer->first = cell;
+    }
+    writer->nodes[writer->count++] = *node;
+}
+
+// Takes the lock of the list for an operation that only reads the list.
+static void read_lock(ListMM list) {
+    if (list->thread_safe) {
+        pthread_rwlock_rdlock(&list->lock);
+    }
+}
+
+// Takes the lock of the list for an operation that changes the list.
+static void write_lock(ListMM list) {
+    if (list->thread_safe) {
+        pthread_rwlock_wrlock(&list->lock);
+    }
+}
+
+// Releases the lock of the list.
+static void unlock(ListMM list) {
+    if (list->thread_safe) {
+        pthread_rwlock_unlock(&list->lock);
+    }
+}
+
+// Returns the time at which an operation on the list starts, if its latency
+// is recorded.
+static uint64_t start_operation(ListMM list) {
+    return list->latency == NULL ? 0 : latency_now_ns();
+}
+
+// Records the latency of an operation on the list that started at start.
+static void end_operation(ListMM list, ListOperation operation, uint64_t start) {
+    if (list->latency != NULL) {
+        latency_histogram_record(list->latency[operation], latency_now_ns() - start);
+    }
+}
+
 // Creates a new list.
 ListMM list_create(const char* file_name) {
-    ListMM list = malloc(sizeof(struct ListMM_));
-    list->file_mem = create_file(file_name, sizeof(ListMMIndex), sizeof(struct Node_));
-    if (list->file_mem == NULL) {
-        free(list);
-        list = NULL;
-    } else {
-        list->index.head = NULL_CELL;
-        list->index.tail = NULL_CELL;
-        list->index.size = 0;
+    return list_create_with_options(file_name, NULL);
+}
+
+// Creates a new list whose file is configured by options.
+ListMM list_create_with_options(const char* file_name, const FileMemOptions* options) {
+    ListMM list = new_list(create_file_with_options(file_name, sizeof(ListMMIndex), sizeof(struct Node_), options));
+    if (list != NULL) {
+        clear_index(&list->index);
+        share(list, options);
+    }
+    return list;
+}
+
+// Creates a new list that only exists in memory.
+ListMM list_create_in_memory(void) {
+    ListMM list = new_list(create_memory_file(sizeof(ListMMIndex), sizeof(struct Node_)));
+    if (list != NULL) {
+        clear_index(&list->index);
     }
     return list;
 }
 
+// Saves the list to a new file, which can then be opened with
+// list_open. Returns false if the file already exists or could not
+// be written.
+bool list_dump(ListMM list, const char* file_name) {
+    read_lock(list);
+    bool dumped = file_mem_dump(list->file_mem, file_name);
+    unlock(list);
+    return dumped;
+}
+
+// Copies the list to a new file whose name is file_name, and opens the
+// copy. The copy is made by file_mem_dump, which clones the blocks of the
+// file when the file system supports it.
+ListMM list_clone(ListMM list, const char* file_name) {
+    return list_dump(list, file_name) ? list_open(file_name) : NULL;
+}
+
 // Destroys a list.
 void list_destroy(ListMM list) {
+    reclaim(list, UINT64_MAX);
     close_file(list->file_mem);
-    free(list);
+    free_list(list);
 }
 
-// Opens a list.
+// Opens a list. Returns NULL if the file does not hold a list.
 ListMM list_open(const char* file_name) {
-    ListMM list = malloc(sizeof(struct ListMM_));
-    list->file_mem = open_file(file_name);
-    if (list->file_mem == NULL) {
-        free(list);
+    return list_open_with_options(file_name, NULL);
+}
+
+// Opens a list whose file is configured by options, or returns NULL
+// if it could not be opened or does not hold a list.
+ListMM list_open_with_options(const char* file_name, const FileMemOptions* options) {
+    ListMM list = new_list(open_file_with_options(file_name, options));
+    if (list == NULL) {
         return NULL;
-    } else {
+    }
+    // Files created before lists had id indexes have a smaller index.
+    FileMemInfo info = file_mem_info(list->file_mem);
+    if (info.index_size > (int)sizeof(ListMMIndex) || info.cell_size != (int)sizeof(Node_)) {
+        close_file(list->file_mem);
+        free_list(list);
+        return NULL;
+    }
+    memset(&list->index, 0, sizeof(ListMMIndex));
+    read_index(list->file_mem, (void*)&(list->index));
+    if (options != NULL && options->mode == FILE_MEM_SHARED_WRITER && has_id_index(list)) {
+        id_index_destroy(list->file_mem, &list->index.ids);
+        commit(list);
+    }
+    share(list, options);
+    return list;
+}
+
+// Loads the latest changes committed by the writer into a list
+// opened as a shared reader. Returns true if the list changed.
+bool list_refresh(ListMM list) {
+    write_lock(list);
+    bool refreshed = file_mem_refresh(list->file_mem);
+    if (refreshed) {
         read_index(list->file_mem, (void*)&(list->index));
-        return list;
     }
+    unlock(list);
+    return refreshed;
 }
 
 // Closes a list;
 void list_close(ListMM list) {
+    reclaim(list, UINT64_MAX);
     write_index(list->file_mem, (void*)&(list->index));
     close_file(list->file_mem);
-    free(list);
+    free_list(list);
+}
+
+// Makes the list safe to use from several threads at once. Must be called
+// before the list is shared.
+void list_set_thread_safe(ListMM list, bool thread_safe) {
+    list->thread_safe = thread_safe;
 }
 
 // Returns true iff the list contains no elements.
 bool list_is_empty(ListMM list) {
-    return list->index.size == 0;
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    bool is_empty = list->index.size == 0;
+    unlock(list);
+    end_operation(list, LIST_OP_IS_EMPTY, start);
+    return is_empty;
 }
 
 // Returns the number of elements in the list.
 size_t list_size(ListMM list) {
-    return list->index.size;
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    size_t size = list->index.size;
+    unlock(list);
+    end_operation(list, LIST_OP_SIZE, start);
+    return size;
 }
 
 // Inserts the specified element at the first position in the list.
-void list_insert_first(ListMM list, Element* element) {
+static void insert_first(ListMM list, Element* element) {
     Node_ node;
     memcpy(&node.element, element, sizeof(Element));
     FileCell cell = new_cell(list->file_mem);
     if (cell != NULL_CELL) {
+        if (list->index.size == 0) {
+            note_appended(list, cell);
+        } else {
+            mark_unordered(list);
+        }
         node.next = list->index.head;
         list->index.head = cell;
-        if (list_is_empty(list)) {
+        if (list->index.size == 0) {
             list->index.tail = cell;
         }
         list->index.size++;
         write_cell(list->file_mem, cell, (void*)&node);
-        write_index(list->file_mem, (void*)&(list->index));
+        index_id(list, element, cell);
+        commit(list);
     }
 }
 
 // Inserts the specified element at the last position in the list.
-void list_insert_last(ListMM list, Element* element) {
+static void insert_last(ListMM list, Element* element) {
     Node_ node;
     memcpy(&node.element, element, sizeof(Element));
     FileCell cell = new_cell(list->file_mem);
     if (cell != NULL_CELL) {
+        note_appended(list, cell);
         node.next = NULL_CELL;
         write_cell(list->file_mem, cell, (void*)&node);
-        if (list_is_empty(list)) {
+        if (list->index.size == 0) {
             list->index.head = cell;
         } else {
             Node_ prev_node;
@@ -109,39 +577,80 @@ void list_insert_last(ListMM list, Element* element) {
         }
         list->index.tail = cell;
         list->index.size++;
-        write_index(list->file_mem, (void*)&(list->index));
+        index_id(list, element, cell);
+        commit(list);
     }
 }
 
 // Inserts the specified element at the specified position in the list.
-// Range of valid positions: 0, ..., size().
-// If the specified position is 0, insert corresponds to insertFirst.
-// If the specified position is size(), insert corresponds to insertLast.
-void list_insert(ListMM list, Element* element, size_t position) {
+static void insert_at(ListMM list, Element* element, size_t position) {
     if (position == 0) {
-        list_insert_first(list, element);
-    } else if (position == list_size(list)) {
-        list_insert_last(list, element);
+        insert_first(list, element);
+    } else if (position == list->index.size) {
+        insert_last(list, element);
     } else {
         Node_ node;
         memcpy(&node.element, element, sizeof(Element));
         FileCell cell = new_cell(list->file_mem);
         if (cell != NULL_CELL) {
             Node_ prev_node;
-            FileCell prev_cell = list->index.head;
-            read_cell(list->file_mem, prev_cell, (void*)&prev_node);
-            for (size_t i = 0; i < position - 1; i++) {
-                prev_cell = prev_node.next;
-                read_cell(list->file_mem, prev_cell, (void*)&prev_node);
-            }
+            FileCell prev_cell = writable_predecessor(list, position, &prev_node);
+            mark_unordered(list);
             node.next = prev_node.next;
             prev_node.next = cell;
             write_cell(list->file_mem, prev_cell, (void*)&prev_node);
             write_cell(list->file_mem, cell, (void*)&node);
             list->index.size++;
-            write_index(list->file_mem, (void*)&(list->index));
+            index_id(list, element, cell);
+            commit(list);
+        }
+    }
+}
+
+// Inserts the specified element at the first position in the list.
+void list_insert_first(ListMM list, Element* element) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    insert_first(list, element);
+    unlock(list);
+    end_operation(list, LIST_OP_INSERT_FIRST, start);
+}
+
+// Inserts the specified element at the last position in the list.
+void list_insert_last(ListMM list, Element* element) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    insert_last(list, element);
+    unlock(list);
+    end_operation(list, LIST_OP_INSERT_LAST, start);
+}
+
+// Inserts the specified element at the specified position in the list.
+// Range of valid positions: 0, ..., size().
+// If the specified position is 0, insert corresponds to insertFirst.
+// If the specified position is size(), insert corresponds to insertLast.
+void list_insert(ListMM list, Element* element, size_t position) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    insert_at(list, element, position);
+    unlock(list);
+    end_operation(list, LIST_OP_INSERT, start);
+}
+
+// Returns the position in the list described by index of the first
+// occurrence of the specified element, or -1 if it does not occur.
+static int find_in(FileMem file_mem, const ListMMIndex* index, bool (*equal)(Element*, Element*), Element* element) {
+    Node_ node;
+    FileCell cell = index->head;
+    for (size_t position = 0; position < index->size; position++) {
+        read_cell(file_mem, cell, (void*)&node);
+        // if (memcmp(&node.element, element, sizeof(Element)) != 0) {
+        if (equal(&node.element, element)) {
+            return (int)position;
         }
+        cell = node.next;
     }
+    return -1;
 }
 
 // Returns the position in the list of the
@@ -149,124 +658,510 @@ void list_insert(ListMM list, Element* element, size_t position) {
 // or -1 if the specified element does not
 // occur in the list.
 int list_find(ListMM list, bool (*equal)(Element*, Element*), Element* element) {
-    int position = 0;
-    FileCell cell = list->index.head;
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    int position = find_in(list->file_mem, &list->index, equal, element);
+    unlock(list);
+    end_operation(list, LIST_OP_FIND, start);
+    return position;
+}
+
+// Returns the element at the specified position in the list described by
+// index.
+static Element get_in(FileMem file_mem, const ListMMIndex* index, size_t position) {
     Node_ node;
-    read_cell(list->file_mem, cell, (void*)&node);
-    while (cell != NULL_CELL) {
-        // if (memcmp(&node.element, element, sizeof(Element)) != 0) {
-        if (!equal(&node.element, element)) {
+    if (position == index->size - 1) {
+        read_cell(file_mem, index->tail, (void*)&node);
+    } else if (position < index->size) {
+        FileCell cell = index->head;
+        read_cell(file_mem, cell, (void*)&node);
+        for (size_t i = 0; i < position; i++) {
             cell = node.next;
-            read_cell(list->file_mem, cell, (void*)&node);
-            position++;
-        } else {
-            return position;
+            read_cell(file_mem, cell, (void*)&node);
         }
     }
-    return -1;
+    return node.element;
+}
+
+// Returns the first element of the list.
+static Element get_first(ListMM list) {
+    return get_in(list->file_mem, &list->index, 0);
+}
+
+// Returns the last element of the list.
+static Element get_last(ListMM list) {
+    return get_in(list->file_mem, &list->index, list->index.size - 1);
+}
+
+// Returns the element at the specified position in the list.
+static Element get_at(ListMM list, size_t position) {
+    return get_in(list->file_mem, &list->index, position);
 }
 
 // Returns the first element of the list.
 Element list_get_first(ListMM list) {
-    Node_ node;
-    if (!list_is_empty(list)) {
-        FileCell cell = list->index.head;
-        read_cell(list->file_mem, cell, (void*)&node);
-    }
-    return node.element;
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    Element element = get_first(list);
+    unlock(list);
+    end_operation(list, LIST_OP_GET_FIRST, start);
+    return element;
 }
 
 // Returns the last element of the list.
 Element list_get_last(ListMM list) {
-    Node_ node;
-    if (!list_is_empty(list)) {
-        FileCell cell = list->index.tail;
-        read_cell(list->file_mem, cell, (void*)&node);
-    }
-    return node.element;
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    Element element = get_last(list);
+    unlock(list);
+    end_operation(list, LIST_OP_GET_LAST, start);
+    return element;
 }
 
 // Returns the element at the specified position in the list.
 // Range of valid positions: 0, ..., size()-1.
 Element list_get(ListMM list, size_t position) {
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    Element element = get_at(list, position);
+    unlock(list);
+    end_operation(list, LIST_OP_GET, start);
+    return element;
+}
+
+// Copies to out up to count elements of the list, in order, starting with the
+// element at position start, and returns how many were copied. A list stored
+// in order is read from the cell of start on; otherwise, the list is walked
+// from its head once.
+size_t list_get_range(ListMM list, size_t start, size_t count, Element* out) {
+    ListReader reader;
     Node_ node;
-    if (position == 0) {
-        return list_get_first(list);
-    } else if (position == list_size(list) - 1) {
-        return list_get_last(list);
-    } else if (position < list_size(list)) {
-        FileCell cell = list->index.head;
-        read_cell(list->file_mem, cell, (void*)&node);
-        for (size_t i = 0; i < position; i++) {
+    uint64_t started = start_operation(list);
+    read_lock(list);
+    size_t size = list->index.size;
+    count = start >= size ? 0 : count < size - start ? count : size - start;
+    FileCell cell = list->index.head;
+    if (list->index.flags & INDEX_SEQUENTIAL) {
+        cell = (FileCell)(start + 1);
+        reader_init(&reader, list->file_mem, count);
+    } else {
+        reader_init(&reader, list->file_mem, start + count);
+        for (size_t i = 0; i < start && count > 0; i++) {
+            reader_read(&reader, cell, &node);
             cell = node.next;
-            read_cell(list->file_mem, cell, (void*)&node);
         }
     }
-    return node.element;
+    for (size_t i = 0; i < count; i++) {
+        reader_read(&reader, cell, &node);
+        out[i] = node.element;
+        cell = node.next;
+    }
+    unlock(list);
+    end_operation(list, LIST_OP_GET_RANGE, started);
+    return count;
 }
 
-// Removes and returns the element at the first position in the list.
-Element list_remove_first(ListMM list) {
-    Node_ node;
-    Element element;
-    if (!list_is_empty(list)) {
-        FileCell cell = list->index.head;
-        read_cell(list->file_mem, cell, (void*)&node);
-        element = node.element;
-
-        list->index.head = node.next;
-        list->index.size--;
-        write_index(list->file_mem, (void*)&(list->index));
+// A requested position and where its element goes, as sorted by list_get_many.
+typedef struct {
+    size_t position;
+    size_t slot;
+} PositionSlot;
 
-        free_cell(list->file_mem, cell);
-    }
-    return element;
+// Orders position slots by position.
+static int compare_positions(const void* a, const void* b) {
+    size_t x = ((const PositionSlot*)a)->position;
+    size_t y = ((const PositionSlot*)b)->position;
+    return x < y ? -1 : x > y;
 }
 
-// Removes and returns the element at the last position in the list.
-Element list_remove_last(ListMM list) {
-    Node_ tail, prev_node;
-    Element element;
-    if (!list_is_empty(list)) {
-        FileCell prev_cell = list->index.head;
-        read_cell(list->file_mem, prev_cell, (void*)&prev_node);
-        while (prev_node.next != list->index.tail) {
-            prev_cell = prev_node.next;
-            read_cell(list->file_mem, prev_cell, (void*)&prev_node);
+// Copies to out[i] the element at positions[i], for each i < n, and returns how
+// many positions were valid. The positions are sorted, so that the list is
+// walked once, up to the largest; a list stored in order is read at each.
+size_t list_get_many(ListMM list, const size_t* positions, size_t n, Element* out) {
+    ListReader reader;
+    Node_ node;
+    uint64_t start = start_operation(list);
+    PositionSlot* slots = malloc(n * sizeof(PositionSlot));
+    size_t valid = 0;
+    read_lock(list);
+    for (size_t i = 0; i < n; i++) {
+        if (positions[i] < list->index.size) {
+            slots[valid].position = positions[i];
+            slots[valid].slot = i;
+            valid++;
         }
-
-        FileCell tail_cell = prev_node.next;
-        read_cell(list->file_mem, tail_cell, (void*)&tail);
-        element = tail.element;
-
-        prev_node.next = NULL_CELL;
-        write_cell(list->file_mem, prev_cell, (void*)&prev_node);
-
-        list->index.tail = prev_cell;
-        list->index.size--;
-        write_index(list->file_mem, (void*)&(list->index));
-
-        free_cell(list->file_mem, tail_cell);
     }
-    return element;
+    qsort(slots, valid, sizeof(PositionSlot), compare_positions);
+    bool sequential = (list->index.flags & INDEX_SEQUENTIAL) != 0;
+    reader_init(&reader, list->file_mem, valid == 0 ? 0 : sequential ? valid : slots[valid - 1].position + 1);
+    size_t position = 0;
+    for (size_t i = 0; i < valid; i++) {
+        if (sequential) {
+            reader_read(&reader, (FileCell)(slots[i].position + 1), &node);
+        } else {
+            if (i == 0) {
+                reader_read(&reader, list->index.head, &node);
+            }
+            for (; position < slots[i].position; position++) {
+                reader_read(&reader, node.next, &node);
+            }
+        }
+        out[slots[i].slot] = node.element;
+    }
+    unlock(list);
+    free(slots);
+    end_operation(list, LIST_OP_GET_MANY, start);
+    return valid;
 }
 
-// Removes and returns the element at the specified position in the list.
-// Range of valid positions: 0, ..., size()-1.
-Element list_remove(ListMM list, size_t position) {
+// Replaces the element at the specified position in the list with element.
+// The node is rewritten in place, and is only read when its next reference is
+// not known from the index, or the id index needs its previous id: otherwise,
+// a list stored in order, or its last position, needs a single write. In a
+// versioned list, the node and those before it are replaced by copies instead.
+// Pre-condition: position < size().
+static void set_at(ListMM list, size_t position, const Element* element) {
+    ListReader reader;
     Node_ node, prev_node;
-    Element element;
-    if (position == 0) {
-        return list_remove_first(list);
-    } else if (position == list_size(list) - 1) {
-        return list_remove_last(list);
-    } else if (position < list_size(list)) {
-        FileCell prev_cell = list->index.head;
-        read_cell(list->file_mem, prev_cell, (void*)&prev_node);
-        for (size_t i = 0; i < position - 1; i++) {
-            prev_cell = prev_node.next;
-            read_cell(list->file_mem, prev_cell, (void*)&prev_node);
+    FileCell cell;
+    if (list->versioned) {
+        FileCell prev_cell = NULL_CELL;
+        cell = list->index.head;
+        if (position > 0) {
+            prev_cell = writable_predecessor(list, position, &prev_node);
+            cell = prev_node.next;
+        }
+        read_cell(list->file_mem, cell, (void*)&node);
+        release_cell(list, cell);
+        cell = new_cell(list->file_mem);
+        if (position > 0) {
+            prev_node.next = cell;
+            write_cell(list->file_mem, prev_cell, (void*)&prev_node);
+        } else {
+            list->index.head = cell;
+        }
+        if (position == list->index.size - 1) {
+            list->index.tail = cell;
+        }
+        mark_unordered(list);
+    } else if ((list->index.flags & INDEX_SEQUENTIAL) && !has_id_index(list)) {
+        cell = (FileCell)(position + 1);
+        node.next = position + 1 < list->index.size ? cell + 1 : NULL_CELL;
+    } else if (position == list->index.size - 1 && !has_id_index(list)) {
+        cell = list->index.tail;
+        node.next = NULL_CELL;
+    } else if (list->index.flags & INDEX_SEQUENTIAL) {
+        cell = (FileCell)(position + 1);
+        read_cell(list->file_mem, cell, (void*)&node);
+    } else if (position == list->index.size - 1) {
+        cell = list->index.tail;
+        read_cell(list->file_mem, cell, (void*)&node);
+    } else {
+        cell = list->index.head;
+        reader_init(&reader, list->file_mem, position + 1);
+        reader_read(&reader, cell, &node);
+        for (size_t i = 0; i < position; i++) {
+            cell = node.next;
+            reader_read(&reader, cell, &node);
+        }
+    }
+    if (!list->versioned) {
+        reindex_id(list, &node.element, element, cell);
+    }
+    node.element = *element;
+    write_cell(list->file_mem, cell, (void*)&node);
+    commit(list);
+}
+
+// Replaces the element at the specified position in the list with element.
+// Range of valid positions: 0, ..., size()-1.
+void list_set(ListMM list, size_t position, const Element* element) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    if (position < list->index.size) {
+        set_at(list, position, element);
+    }
+    unlock(list);
+    end_operation(list, LIST_OP_SET, start);
+}
+
+// Replaces the first element of the list for which key_equal, called with it
+// and element, returns true with element, or, if there is none, inserts element
+// at the last position. Returns true if an element was replaced. The list is
+// walked once; the last node read is the tail, which the insertion links to.
+// In a versioned list, a matching node and those before it are replaced by
+// copies, which set_at reads again, so that the walk keeps no node.
+static bool upsert(ListMM list, bool (*key_equal)(const Element* a, const Element* b), const Element* element) {
+    ListReader reader;
+    Node_ node = {.next = NULL_CELL};
+    FileCell cell = list->index.head;
+    reader_init(&reader, list->file_mem, list->index.size);
+    for (size_t position = 0; position < list->index.size; position++) {
+        reader_read(&reader, cell, &node);
+        if (key_equal(&node.element, element)) {
+            if (list->versioned) {
+                set_at(list, position, element);
+                return true;
+            }
+            reindex_id(list, &node.element, element, cell);
+            node.element = *element;
+            write_cell(list->file_mem, cell, (void*)&node);
+            commit(list);
+            return true;
+        }
+        if (position + 1 < list->index.size) {
+            cell = node.next;
+        }
+    }
+    Node_ last = node;
+    FileCell last_cell = cell;
+    cell = new_cell(list->file_mem);
+    if (cell != NULL_CELL) {
+        note_appended(list, cell);
+        node.element = *element;
+        node.next = NULL_CELL;
+        write_cell(list->file_mem, cell, (void*)&node);
+        if (list->index.size == 0) {
+            list->index.head = cell;
+        } else {
+            last.next = cell;
+            write_cell(list->file_mem, last_cell, (void*)&last);
+        }
+        list->index.tail = cell;
+        list->index.size++;
+        index_id(list, element, cell);
+        commit(list);
+    }
+    return false;
+}
+
+// Replaces the first element of the list for which key_equal, called with it
+// and element, returns true with element, or, if there is none, inserts element
+// at the last position. Returns true if an element was replaced.
+bool list_upsert(ListMM list, bool (*key_equal)(const Element* a, const Element* b), const Element* element) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    bool replaced = upsert(list, key_equal, element);
+    unlock(list);
+    end_operation(list, LIST_OP_UPSERT, start);
+    return replaced;
+}
+
+// A cursor holds the node at its position, and reads the following ones
+// through a ListReader. In a versioned list, the nodes up to the last one
+// replaced are copies, made by the cursor and not yet committed; the last
+// copy, stored at copy_cell, is only written once the next copy is linked to
+// it, or the cursor is closed. The cursor keeps walking the original nodes.
+struct ListCursor_ {
+    ListMM list;
+    bool writable;
+    size_t position;
+    FileCell cell;
+    Node_ node;
+    ListReader reader;
+    size_t copied;
+    FileCell copy_cell;
+    Node_ copy_node;
+};
+
+// Opens a cursor at the first position of the list, holding its lock, shared
+// or exclusive, until it is closed.
+static ListCursor open_cursor(ListMM list, bool writable) {
+    uint64_t start = start_operation(list);
+    ListCursor cursor = malloc(sizeof(struct ListCursor_));
+    if (writable) {
+        write_lock(list);
+    } else {
+        read_lock(list);
+    }
+    cursor->list = list;
+    cursor->writable = writable;
+    cursor->position = 0;
+    cursor->cell = list->index.head;
+    cursor->copied = 0;
+    cursor->copy_cell = NULL_CELL;
+    reader_init(&cursor->reader, list->file_mem, list->index.size);
+    if (list->index.size > 0) {
+        reader_read(&cursor->reader, cursor->cell, &cursor->node);
+    }
+    end_operation(list, LIST_OP_CURSOR, start);
+    return cursor;
+}
+
+// Opens a cursor at the first position of the list. The cursor holds the
+// lock of the list until it is closed.
+ListCursor list_cursor(ListMM list) {
+    return open_cursor(list, true);
+}
+
+// Opens a cursor at the first position of the list that can only read it.
+// The cursor shares the lock of the list with other readers until it is
+// closed.
+ListCursor list_read_cursor(ListMM list) {
+    return open_cursor(list, false);
+}
+
+// Returns true if the cursor is at an element of the list, or false if it is
+// past the last one.
+bool list_cursor_valid(ListCursor cursor) {
+    return cursor->position < cursor->list->index.size;
+}
+
+// Returns the element at the position of the cursor.
+Element list_cursor_get(ListCursor cursor) {
+    return cursor->node.element;
+}
+
+// Replaces, in a versioned list, the element at the position of the cursor
+// with element. The nodes from the last one the cursor copied up to its
+// position are copied and linked after that copy, so a pass over the list
+// copies each node once, and reads again only those it did not replace.
+static void copy_to_cursor(ListCursor cursor, const Element* element) {
+    ListMM list = cursor->list;
+    Node_ node;
+    if (cursor->copied > cursor->position) {
+        cursor->copy_node.element = *element;
+        return;
+    }
+    FileCell cell = cursor->copied == 0 ? list->index.head : cursor->copy_node.next;
+    for (size_t position = cursor->copied; position <= cursor->position; position++) {
+        if (position == cursor->position) {
+            node = cursor->node;
+            node.element = *element;
+        } else {
+            read_cell(list->file_mem, cell, (void*)&node);
+        }
+        FileCell copy = new_cell(list->file_mem);
+        if (position == 0) {
+            list->index.head = copy;
+        } else {
+            cursor->copy_node.next = copy;
+            write_cell(list->file_mem, cursor->copy_cell, (void*)&cursor->copy_node);
+        }
+        release_cell(list, cell);
+        cursor->copy_cell = copy;
+        cursor->copy_node = node;
+        cell = node.next;
+    }
+    if (cursor->position == list->index.size - 1) {
+        list->index.tail = cursor->copy_cell;
+    }
+    cursor->copied = cursor->position + 1;
+    cursor->cell = cursor->copy_cell;
+    mark_unordered(list);
+}
+
+// Replaces the element at the position of the cursor with element, which,
+// unless the list is versioned, rewrites its cell and nothing else. Returns
+// false, changing nothing, if the cursor is read-only or past the last element.
+bool list_cursor_set(ListCursor cursor, const Element* element) {
+    ListMM list = cursor->list;
+    if (!cursor->writable || !list_cursor_valid(cursor)) {
+        return false;
+    }
+    uint64_t start = start_operation(list);
+    if (list->versioned) {
+        copy_to_cursor(cursor, element);
+    } else {
+        reindex_id(list, &cursor->node.element, element, cursor->cell);
+        cursor->node.element = *element;
+        write_cell(list->file_mem, cursor->cell, (void*)&cursor->node);
+        commit(list);
+    }
+    cursor->node.element = *element;
+    end_operation(list, LIST_OP_CURSOR_SET, start);
+    return true;
+}
+
+// Moves the cursor to the next position of the list.
+void list_cursor_next(ListCursor cursor) {
+    if (!list_cursor_valid(cursor)) {
+        return;
+    }
+    uint64_t start = start_operation(cursor->list);
+    cursor->position++;
+    cursor->cell = cursor->node.next;
+    if (list_cursor_valid(cursor)) {
+        reader_read(&cursor->reader, cursor->cell, &cursor->node);
+    }
+    end_operation(cursor->list, LIST_OP_CURSOR_NEXT, start);
+}
+
+// Closes the cursor, releasing the lock of the list. In a versioned list, the
+// elements replaced through the cursor are committed now.
+void list_cursor_close(ListCursor cursor) {
+    ListMM list = cursor->list;
+    uint64_t start = start_operation(list);
+    if (cursor->copied > 0) {
+        write_cell(list->file_mem, cursor->copy_cell, (void*)&cursor->copy_node);
+        commit(list);
+    }
+    unlock(list);
+    free(cursor);
+    end_operation(list, LIST_OP_CURSOR_CLOSE, start);
+}
+
+// Removes and returns the element at the first position in the list.
+static Element remove_first(ListMM list) {
+    Node_ node;
+    Element element;
+    if (list->index.size > 0) {
+        FileCell cell = list->index.head;
+        read_cell(list->file_mem, cell, (void*)&node);
+        element = node.element;
+
+        list->index.head = node.next;
+        if (list->index.size == 1) {
+            list->index.tail = NULL_CELL;
+        }
+        mark_unordered(list);
+        list->index.size--;
+        unindex_id(list, &element, cell);
+        release_cell(list, cell);
+        commit(list);
+    }
+    return element;
+}
+
+// Removes and returns the element at the last position in the list.
+static Element remove_last(ListMM list) {
+    Node_ tail, prev_node;
+    Element element;
+    if (list->index.size == 1) {
+        return remove_first(list);
+    } else if (list->index.size > 1) {
+        FileCell prev_cell = writable_predecessor(list, list->index.size - 1, &prev_node);
+        if (list->versioned) {
+            mark_unordered(list);
         }
+
+        FileCell tail_cell = prev_node.next;
+        read_cell(list->file_mem, tail_cell, (void*)&tail);
+        element = tail.element;
+
+        prev_node.next = NULL_CELL;
+        write_cell(list->file_mem, prev_cell, (void*)&prev_node);
+
+        list->index.tail = prev_cell;
+        list->index.size--;
+        unindex_id(list, &element, tail_cell);
+        release_cell(list, tail_cell);
+        commit(list);
+    }
+    return element;
+}
+
+// Removes and returns the element at the specified position in the list.
+static Element remove_at(ListMM list, size_t position) {
+    Node_ node, prev_node;
+    Element element;
+    if (position == 0) {
+        return remove_first(list);
+    } else if (position == list->index.size - 1) {
+        return remove_last(list);
+    } else if (position < list->index.size) {
+        FileCell prev_cell = writable_predecessor(list, position, &prev_node);
+        mark_unordered(list);
         FileCell cell = prev_node.next;
         read_cell(list->file_mem, cell, (void*)&node);
         element = node.element;
@@ -275,24 +1170,1023 @@ Element list_remove(ListMM list, size_t position) {
         write_cell(list->file_mem, prev_cell, (void*)&prev_node);
 
         list->index.size--;
-        write_index(list->file_mem, (void*)&(list->index));
-        free_cell(list->file_mem, cell);
+        unindex_id(list, &element, cell);
+        release_cell(list, cell);
+        commit(list);
     }
     return element;
 }
 
+// Removes and returns the element at the first position in the list.
+Element list_remove_first(ListMM list) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    Element element = remove_first(list);
+    unlock(list);
+    end_operation(list, LIST_OP_REMOVE_FIRST, start);
+    return element;
+}
+
+// Removes and returns the element at the last position in the list.
+Element list_remove_last(ListMM list) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    Element element = remove_last(list);
+    unlock(list);
+    end_operation(list, LIST_OP_REMOVE_LAST, start);
+    return element;
+}
+
+// Removes and returns the element at the specified position in the list.
+// Range of valid positions: 0, ..., size()-1.
+Element list_remove(ListMM list, size_t position) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    Element element = remove_at(list, position);
+    unlock(list);
+    end_operation(list, LIST_OP_REMOVE, start);
+    return element;
+}
+
+// Removes up to count elements of the list, starting with the element at
+// position start, and returns how many were removed. The block is unlinked by
+// a single change to its predecessor, or to the head.
+static size_t remove_range(ListMM list, size_t start, size_t count) {
+    ListReader reader;
+    Node_ node, prev_node;
+    size_t size = list->index.size;
+    count = start >= size ? 0 : count < size - start ? count : size - start;
+    if (count == 0) {
+        return 0;
+    }
+    FileCell prev_cell = NULL_CELL;
+    FileCell cell = list->index.head;
+    if (start > 0) {
+        prev_cell = writable_predecessor(list, start, &prev_node);
+        cell = prev_node.next;
+    }
+    FileCell* removed = malloc(count * sizeof(FileCell));
+    if (!list->versioned && (list->index.flags & INDEX_SEQUENTIAL) && !has_id_index(list)) {
+        for (size_t i = 0; i < count; i++) {
+            removed[i] = (FileCell)(start + i + 1);
+        }
+        cell = start + count < size ? (FileCell)(start + count + 1) : NULL_CELL;
+    } else {
+        reader_init(&reader, list->file_mem, count);
+        for (size_t i = 0; i < count; i++) {
+            removed[i] = cell;
+            reader_read(&reader, cell, &node);
+            unindex_id(list, &node.element, cell);
+            cell = node.next;
+        }
+    }
+    if (start > 0) {
+        prev_node.next = cell;
+        write_cell(list->file_mem, prev_cell, (void*)&prev_node);
+    } else {
+        list->index.head = cell;
+    }
+    if (cell == NULL_CELL) {
+        list->index.tail = prev_cell;
+    }
+    if (list->versioned || cell != NULL_CELL) {
+        mark_unordered(list);
+    }
+    list->index.size -= count;
+    release_cells(list, removed, count);
+    free(removed);
+    commit(list);
+    return count;
+}
+
+// Removes up to count elements of the list, starting with the element at
+// position start, and returns how many were removed.
+size_t list_remove_range(ListMM list, size_t start, size_t count) {
+    uint64_t started = start_operation(list);
+    write_lock(list);
+    size_t removed = remove_range(list, start, count);
+    unlock(list);
+    end_operation(list, LIST_OP_REMOVE_RANGE, started);
+    return removed;
+}
+
+// Orders positions increasingly.
+static int compare_sizes(const void* a, const void* b) {
+    size_t x = *(const size_t*)a;
+    size_t y = *(const size_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Decides whether remove_matching removes the element at position.
+typedef bool (*RemovalTest)(size_t position, const Element* element, void* ctx);
+
+// Removes the elements up to position last for which removes returns true,
+// and returns how many were removed. The list is walked once, and each node
+// that is kept is written once, if its next reference changes. The cells of
+// the removed nodes are released together at the end. In a versioned list,
+// every node kept before last is replaced by a copy, as writable_predecessor
+// does, so the element at last must be removed.
+static size_t remove_matching(ListMM list, size_t last, RemovalTest removes, void* ctx) {
+    ListReader reader;
+    Node_ node, kept_node;
+    FileCell kept_cell = NULL_CELL;
+    bool kept_dirty = false;
+    bool kept_after_removed = false;
+    FileCell head = NULL_CELL;
+    FileCell* removed = NULL;
+    size_t num_removed = 0, capacity = 0;
+    FileCell cell = list->index.head;
+    reader_init(&reader, list->file_mem, last + 1);
+    for (size_t position = 0; position <= last; position++) {
+        reader_read(&reader, cell, &node);
+        FileCell next = node.next;
+        if (removes(position, &node.element, ctx)) {
+            if (num_removed == capacity) {
+                capacity = capacity == 0 ? 64 : 2 * capacity;
+                removed = realloc(removed, capacity * sizeof(FileCell));
+            }
+            removed[num_removed++] = cell;
+            unindex_id(list, &node.element, cell);
+        } else {
+            FileCell copy = cell;
+            if (list->versioned) {
+                copy = new_cell(list->file_mem);
+                release_cell(list, cell);
+            }
+            if (kept_cell == NULL_CELL) {
+                head = copy;
+            } else {
+                if (kept_node.next != copy) {
+                    kept_node.next = copy;
+                    kept_dirty = true;
+                }
+                if (kept_dirty) {
+                    write_cell(list->file_mem, kept_cell, (void*)&kept_node);
+                }
+            }
+            kept_cell = copy;
+            kept_node = node;
+            kept_dirty = list->versioned;
+            kept_after_removed = kept_after_removed || num_removed > 0;
+        }
+        cell = next;
+    }
+    if (num_removed == 0) {
+        return 0;
+    }
+    if (kept_cell == NULL_CELL) {
+        head = cell;
+    } else {
+        if (kept_node.next != cell) {
+            kept_node.next = cell;
+            kept_dirty = true;
+        }
+        if (kept_dirty) {
+            write_cell(list->file_mem, kept_cell, (void*)&kept_node);
+        }
+    }
+    list->index.head = head;
+    if (cell == NULL_CELL) {
+        list->index.tail = kept_cell;
+    }
+    if (list->versioned || kept_after_removed || cell != NULL_CELL) {
+        mark_unordered(list);
+    }
+    list->index.size -= num_removed;
+    release_cells(list, removed, num_removed);
+    free(removed);
+    commit(list);
+    return num_removed;
+}
+
+// The distinct positions, in increasing order, removed by remove_positions.
+typedef struct {
+    const size_t* sorted;
+    size_t next;
+} SortedPositions;
+
+// Returns true if position is the next one of the sorted positions.
+static bool removes_position(size_t position, const Element* element, void* ctx) {
+    SortedPositions* positions = (SortedPositions*)ctx;
+    (void)element;
+    if (position != positions->sorted[positions->next]) {
+        return false;
+    }
+    positions->next++;
+    return true;
+}
+
+// Removes the elements at the n specified positions, which may be in any order
+// and repeat, and returns how many were removed. Positions refer to the list
+// before the removal; those past its end are ignored.
+size_t list_remove_positions(ListMM list, const size_t* positions, size_t n) {
+    uint64_t start = start_operation(list);
+    size_t* sorted = malloc(n * sizeof(size_t));
+    size_t k = 0;
+    write_lock(list);
+    for (size_t i = 0; i < n; i++) {
+        if (positions[i] < list->index.size) {
+            sorted[k++] = positions[i];
+        }
+    }
+    qsort(sorted, k, sizeof(size_t), compare_sizes);
+    size_t distinct = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (distinct == 0 || sorted[i] != sorted[distinct - 1]) {
+            sorted[distinct++] = sorted[i];
+        }
+    }
+    if (distinct > 0) {
+        SortedPositions sorted_positions = {sorted, 0};
+        remove_matching(list, sorted[distinct - 1], removes_position, &sorted_positions);
+    }
+    unlock(list);
+    free(sorted);
+    end_operation(list, LIST_OP_REMOVE_POSITIONS, start);
+    return distinct;
+}
+
+// A predicate and its context, as given to list_remove_if.
+typedef struct {
+    bool (*pred)(const Element* element, void* ctx);
+    void* ctx;
+} RemovalPredicate;
+
+// Returns true if the predicate holds for element.
+static bool removes_matching(size_t position, const Element* element, void* ctx) {
+    RemovalPredicate* predicate = (RemovalPredicate*)ctx;
+    (void)position;
+    return predicate->pred(element, predicate->ctx);
+}
+
+// Removes the elements of the list for which pred, called with each element,
+// in order, and ctx, returns true, and returns how many were removed. In a
+// versioned list, the positions of the matching elements are found first, so
+// that only the nodes before the last one are copied.
+static size_t remove_if(ListMM list, bool (*pred)(const Element* element, void* ctx), void* ctx) {
+    RemovalPredicate predicate = {pred, ctx};
+    size_t removed = 0;
+    if (!list->versioned) {
+        if (list->index.size > 0) {
+            removed = remove_matching(list, list->index.size - 1, removes_matching, &predicate);
+        }
+        return removed;
+    }
+    ListReader reader;
+    Node_ node;
+    size_t* positions = NULL;
+    size_t capacity = 0;
+    FileCell cell = list->index.head;
+    reader_init(&reader, list->file_mem, list->index.size);
+    for (size_t position = 0; position < list->index.size; position++) {
+        reader_read(&reader, cell, &node);
+        if (pred(&node.element, ctx)) {
+            if (removed == capacity) {
+                capacity = capacity == 0 ? 64 : 2 * capacity;
+                positions = realloc(positions, capacity * sizeof(size_t));
+            }
+            positions[removed++] = position;
+        }
+        cell = node.next;
+    }
+    if (removed > 0) {
+        SortedPositions sorted_positions = {positions, 0};
+        remove_matching(list, positions[removed - 1], removes_position, &sorted_positions);
+    }
+    free(positions);
+    return removed;
+}
+
+// Removes the elements of the list for which pred, called with each element,
+// in order, and ctx, returns true, and returns how many were removed.
+size_t list_remove_if(ListMM list, bool (*pred)(const Element* element, void* ctx), void* ctx) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    size_t removed = remove_if(list, pred, ctx);
+    unlock(list);
+    end_operation(list, LIST_OP_REMOVE_IF, start);
+    return removed;
+}
+
 // Removes all elements from the list.
 void list_make_empty(ListMM list) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
     Node_ node;
     FileCell cell = list->index.head;
-    read_cell(list->file_mem, cell, (void*)&node);
     while (cell != NULL_CELL) {
+        read_cell(list->file_mem, cell, (void*)&node);
+        release_cell(list, cell);
+        cell = node.next;
+    }
+    bool indexed = has_id_index(list);
+    id_index_destroy(list->file_mem, &list->index.ids);
+    clear_index(&list->index);
+    if (indexed) {
+        id_index_create(list->file_mem, &list->index.ids, 0);
+    }
+    commit(list);
+    unlock(list);
+    end_operation(list, LIST_OP_MAKE_EMPTY, start);
+}
+
+// Inserts count elements, in order, at the end of the list.
+static void append(ListMM list, const Element* elements, size_t count) {
+    Node_ node;
+    if (count == 0) {
+        return;
+    }
+    FileCell first = new_cell(list->file_mem);
+    FileCell cell = first;
+    note_appended(list, first);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(&node.element, &elements[i], sizeof(Element));
+        node.next = i + 1 < count ? new_cell(list->file_mem) : NULL_CELL;
+        write_cell(list->file_mem, cell, (void*)&node);
+        index_id(list, &elements[i], cell);
+        if (node.next != NULL_CELL) {
+            if (node.next != cell + 1) {
+                mark_unordered(list);
+            }
+            cell = node.next;
+        }
+    }
+    if (list->index.size == 0) {
+        list->index.head = first;
+    } else {
+        read_cell(list->file_mem, list->index.tail, (void*)&node);
+        node.next = first;
+        write_cell(list->file_mem, list->index.tail, (void*)&node);
+    }
+    list->index.tail = cell;
+    list->index.size += count;
+    commit(list);
+}
+
+// Inserts count elements, in order, at the end of the list, with a single
+// commit.
+void list_append(ListMM list, const Element* elements, size_t count) {
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    append(list, elements, count);
+    unlock(list);
+    end_operation(list, LIST_OP_APPEND, start);
+}
+
+// Calls visit with each element of the list, in order, and ctx, until visit
+// returns false.
+void list_for_each(ListMM list, bool (*visit)(const Element* element, void* ctx), void* ctx) {
+    ListReader reader;
+    Node_ node;
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    FileCell cell = list->index.head;
+    reader_init(&reader, list->file_mem, list->index.size);
+    for (size_t position = 0; position < list->index.size; position++) {
+        reader_read(&reader, cell, &node);
+        if (!visit(&node.element, ctx)) {
+            break;
+        }
+        cell = node.next;
+    }
+    unlock(list);
+    end_operation(list, LIST_OP_FOR_EACH, start);
+}
+
+// Calls transform with each element of the list, in order, and ctx, letting
+// it change the element, which it reports by returning true. Changed nodes are
+// written in place, those in consecutive cells together. In a versioned list,
+// every node is replaced by a copy instead, since pinned versions must keep
+// the elements they had.
+void list_map(ListMM list, bool (*transform)(Element* element, void* ctx), void* ctx) {
+    ListReader reader;
+    ListWriter writer;
+    Node_ node;
+    uint64_t start = start_operation(list);
+    write_lock(list);
+    size_t size = list->index.size;
+    FileCell cell = list->index.head;
+    FileCell copy = list->versioned && size > 0 ? new_cell(list->file_mem) : NULL_CELL;
+    reader_init(&reader, list->file_mem, size);
+    writer_init(&writer, list->file_mem);
+    if (list->versioned && size > 0) {
+        list->index.head = copy;
+        mark_unordered(list);
+    }
+    for (size_t position = 0; position < size; position++) {
+        reader_read(&reader, cell, &node);
+        FileCell next = node.next;
+        Element old_element = node.element;
+        bool changed = transform(&node.element, ctx);
+        if (changed && !list->versioned) {
+            reindex_id(list, &old_element, &node.element, cell);
+        }
+        if (list->versioned) {
+            release_cell(list, cell);
+            cell = copy;
+            node.next = position + 1 < size ? new_cell(list->file_mem) : NULL_CELL;
+            copy = node.next;
+            changed = true;
+        }
+        if (changed) {
+            writer_write(&writer, cell, &node);
+        }
+        if (position + 1 == size) {
+            list->index.tail = cell;
+        }
+        cell = next;
+    }
+    writer_flush(&writer);
+    commit(list);
+    unlock(list);
+    end_operation(list, LIST_OP_MAP, start);
+}
+
+// Returns the result of combining initial with each element of the list, in
+// order, as combine does with the result so far, the element and ctx.
+long long list_fold(ListMM list, long long initial, long long (*combine)(long long acc, const Element* element, void* ctx),
+                    void* ctx) {
+    ListReader reader;
+    Node_ node;
+    long long acc = initial;
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    FileCell cell = list->index.head;
+    reader_init(&reader, list->file_mem, list->index.size);
+    for (size_t position = 0; position < list->index.size; position++) {
+        reader_read(&reader, cell, &node);
+        acc = combine(acc, &node.element, ctx);
         cell = node.next;
+    }
+    unlock(list);
+    end_operation(list, LIST_OP_FOLD, start);
+    return acc;
+}
+
+// Counts a cell of the id index in the size_t pointed to by ctx.
+static bool count_cell(FileCell cell, void* ctx) {
+    (void)cell;
+    (*(size_t*)ctx)++;
+    return true;
+}
+
+// Returns the size and layout of the list file.
+ListMMInfo list_info(ListMM list) {
+    ListMMInfo info;
+    Node_ node;
+    read_lock(list);
+    FileMemInfo file_info = file_mem_info(list->file_mem);
+    info.size = list->index.size;
+    info.num_cells = file_info.num_cells;
+    info.free_cells = file_info.free_cells;
+    info.retired_cells = file_info.retired_cells;
+    info.file_size = file_info.file_size;
+    info.out_of_order = 0;
+    info.sequential = (list->index.flags & INDEX_SEQUENTIAL) != 0;
+    info.id_index_cells = 0;
+    id_index_for_each_cell(list->file_mem, &list->index.ids, count_cell, &info.id_index_cells);
+    FileCell cell = list->index.head;
+    for (size_t position = 0; position + 1 < list->index.size; position++) {
         read_cell(list->file_mem, cell, (void*)&node);
-        free_cell(list->file_mem, cell);
+        if (node.next != cell + 1) {
+            info.out_of_order++;
+        }
+        cell = node.next;
     }
-    list->index.head = NULL_CELL;
-    list->index.tail = NULL_CELL;
-    list->index.size = 0;
-    write_index(list->file_mem, (void*)&(list->index));
-}
\ No newline at end of file
+    unlock(list);
+    return info;
+}
+
+// Marks the cell whose reference is cell as reached, and returns true, unless
+// it is not a cell of the file or was already reached, which is reported.
+static bool reach(unsigned char* reached, int num_cells, FileCell cell, const char* what, size_t* problems,
+                  FILE* report) {
+    if (cell <= 0 || cell > num_cells) {
+        if (report != NULL) {
+            fprintf(report, "%s refers to cell %d, outside the file of %d cells.\n", what, cell, num_cells);
+        }
+        (*problems)++;
+        return false;
+    }
+    if (reached[cell - 1]) {
+        if (report != NULL) {
+            fprintf(report, "%s refers to cell %d, which was already reached.\n", what, cell);
+        }
+        (*problems)++;
+        return false;
+    }
+    reached[cell - 1] = 1;
+    return true;
+}
+
+// The cells reached by list_verify, and what is needed to report problems.
+typedef struct {
+    unsigned char* reached;
+    int num_cells;
+    size_t* problems;
+    FILE* report;
+    size_t count;
+} Reach;
+
+// Marks a cell of the id index as reached, as described by ctx.
+static bool reach_index_cell(FileCell cell, void* ctx) {
+    Reach* index_reach = (Reach*)ctx;
+    if (!reach(index_reach->reached, index_reach->num_cells, cell, "The id index", index_reach->problems,
+               index_reach->report)) {
+        return false;
+    }
+    index_reach->count++;
+    return true;
+}
+
+// Checks that the elements of the list and the free cells of its file
+// account for every cell exactly once. Returns the number of problems.
+size_t list_verify(ListMM list, FILE* report) {
+    Node_ node;
+    size_t problems = 0;
+    read_lock(list);
+    FileMemInfo file_info = file_mem_info(list->file_mem);
+    unsigned char* reached = calloc(file_info.num_cells > 0 ? file_info.num_cells : 1, 1);
+
+    FileCell cell = list->index.head;
+    FileCell last = NULL_CELL;
+    size_t position = 0;
+    while (cell != NULL_CELL && position < list->index.size) {
+        if (!reach(reached, file_info.num_cells, cell, "The list", &problems, report)) {
+            break;
+        }
+        read_cell(list->file_mem, cell, (void*)&node);
+        last = cell;
+        cell = node.next;
+        position++;
+    }
+    if (position != list->index.size) {
+        if (report != NULL) {
+            fprintf(report, "The list has %zu elements, but only %zu could be reached.\n", list->index.size, position);
+        }
+        problems++;
+    } else if (cell != NULL_CELL) {
+        if (report != NULL) {
+            fprintf(report, "The last element links to cell %d.\n", cell);
+        }
+        problems++;
+    }
+    if (last != list->index.tail && problems == 0) {
+        if (report != NULL) {
+            fprintf(report, "The tail is cell %d, but the last element is in cell %d.\n", list->index.tail, last);
+        }
+        problems++;
+    }
+
+    size_t num_free = 0;
+    for (cell = file_mem_free_list(list->file_mem); cell != NULL_CELL; cell = get_next_file_cell(list->file_mem, cell)) {
+        if (!reach(reached, file_info.num_cells, cell, "The free list", &problems, report)) {
+            break;
+        }
+        num_free++;
+    }
+    Reach index_reach = {reached, file_info.num_cells, &problems, report, 0};
+    id_index_for_each_cell(list->file_mem, &list->index.ids, reach_index_cell, &index_reach);
+    if (has_id_index(list) && list->index.ids.entries != list->index.size) {
+        if (report != NULL) {
+            fprintf(report, "The id index has %llu entries for %zu elements.\n",
+                    (unsigned long long)list->index.ids.entries, list->index.size);
+        }
+        problems++;
+    }
+    size_t lost = file_info.num_cells - position - num_free - index_reach.count - file_info.retired_cells;
+    if (lost > 0 && problems == 0) {
+        if (report != NULL) {
+            fprintf(report, "%zu cells are neither in the list nor free.\n", lost);
+        }
+        problems++;
+    }
+    free(reached);
+    unlock(list);
+    return problems;
+}
+
+// Writes size bytes from buffer to the file descriptor fd, retrying partial
+// writes. Returns false on failure.
+static bool write_fully(int fd, const void* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t written = write(fd, (const unsigned char*)buffer + done, size - done);
+        if (written <= 0) {
+            return false;
+        }
+        done += written;
+    }
+    return true;
+}
+
+// Reads size bytes from the file descriptor fd into buffer, retrying partial
+// reads. Returns false if there are fewer bytes.
+static bool read_fully(int fd, void* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t read_size = read(fd, (unsigned char*)buffer + done, size - done);
+        if (read_size <= 0) {
+            return false;
+        }
+        done += read_size;
+    }
+    return true;
+}
+
+// Writes a snapshot of a list whose elements are stored in order in its first
+// cells as those cells, next references included, which the file memory sends
+// to fd without copying them through the process when it can.
+static bool export_cells(ListMM list, int fd) {
+    uint32_t header[3] = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, sizeof(Node_)};
+    uint64_t count = list->index.size;
+    unsigned char header_bytes[SNAPSHOT_HEADER_SIZE];
+    memcpy(header_bytes, header, sizeof(header));
+    memcpy(header_bytes + sizeof(header), &count, sizeof(count));
+    bool written = write_fully(fd, header_bytes, SNAPSHOT_HEADER_SIZE);
+    for (uint64_t done = 0; done < count && written; done += SEND_BATCH) {
+        size_t n = count - done < SEND_BATCH ? (size_t)(count - done) : SEND_BATCH;
+        written = file_mem_send_cells(list->file_mem, (FileCell)(done + 1), (int)n, fd);
+    }
+    return written;
+}
+
+// Writes the elements of the list, in order, to the file descriptor fd as a
+// snapshot. Elements are gathered in a large buffer between writes, unless the
+// list is stored in order, in which case its cells are sent as they are.
+bool list_export_snapshot(ListMM list, int fd) {
+    read_lock(list);
+    if (list->index.flags & INDEX_SEQUENTIAL) {
+        bool written = export_cells(list, fd);
+        unlock(list);
+        return written;
+    }
+    unsigned char* buffer = malloc(SNAPSHOT_BUFFER_SIZE);
+    uint32_t header[3] = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, sizeof(Element)};
+    Node_ node;
+    uint64_t count = list->index.size;
+    memcpy(buffer, header, sizeof(header));
+    memcpy(buffer + sizeof(header), &count, sizeof(count));
+    size_t used = SNAPSHOT_HEADER_SIZE;
+    bool written = true;
+    FileCell cell = list->index.head;
+    for (size_t position = 0; position < list->index.size && written; position++) {
+        if (used + sizeof(Element) > SNAPSHOT_BUFFER_SIZE) {
+            written = write_fully(fd, buffer, used);
+            used = 0;
+        }
+        read_cell(list->file_mem, cell, (void*)&node);
+        memcpy(buffer + used, &node.element, sizeof(Element));
+        used += sizeof(Element);
+        cell = node.next;
+    }
+    unlock(list);
+    written = written && write_fully(fd, buffer, used);
+    free(buffer);
+    return written;
+}
+
+// Creates a list in the file whose name is file_name from the snapshot read
+// from the file descriptor fd. The nodes of each buffer of records are
+// allocated together at the end of the file and written with a single write.
+// Records that are whole cells have their next references rewritten, since
+// the cells are allocated anew.
+ListMM list_import_snapshot(const char* file_name, int fd) {
+    uint32_t header[3];
+    uint64_t count;
+    unsigned char header_bytes[SNAPSHOT_HEADER_SIZE];
+    if (!read_fully(fd, header_bytes, SNAPSHOT_HEADER_SIZE)) {
+        return NULL;
+    }
+    memcpy(header, header_bytes, sizeof(header));
+    memcpy(&count, header_bytes + sizeof(header), sizeof(count));
+    bool cells = header[2] == sizeof(Node_);
+    if (header[0] != SNAPSHOT_MAGIC || header[1] != SNAPSHOT_VERSION || (header[2] != sizeof(Element) && !cells)) {
+        return NULL;
+    }
+    ListMM list = list_create(file_name);
+    if (list == NULL) {
+        return NULL;
+    }
+    size_t batch = SNAPSHOT_BUFFER_SIZE / sizeof(Node_);
+    Element* elements = malloc(batch * sizeof(Element));
+    Node nodes = malloc(batch * sizeof(Node_));
+    bool complete = true;
+    for (uint64_t done = 0; done < count && complete; done += batch) {
+        size_t n = count - done < batch ? (size_t)(count - done) : batch;
+        complete = cells ? read_fully(fd, nodes, n * sizeof(Node_)) : read_fully(fd, elements, n * sizeof(Element));
+        if (complete) {
+            FileCell first = new_cells(list->file_mem, (int)n);
+            for (size_t i = 0; i < n; i++) {
+                if (!cells) {
+                    nodes[i].element = elements[i];
+                }
+                nodes[i].next = done + i + 1 < count ? first + (FileCell)i + 1 : NULL_CELL;
+            }
+            write_cells(list->file_mem, first, (int)n, nodes);
+            if (done == 0) {
+                list->index.head = first;
+            }
+            list->index.tail = first + (FileCell)n - 1;
+        }
+    }
+    free(elements);
+    free(nodes);
+    if (!complete) {
+        list_destroy(list);
+        remove(file_name);
+        return NULL;
+    }
+    list->index.size = count;
+    commit(list);
+    return list;
+}
+
+// The id index stores its chain heads and entries in cells of the list file.
+_Static_assert(sizeof(Node_) == ID_INDEX_CELL_SIZE, "id index cells must be the size of list nodes");
+_Static_assert(sizeof(((Element*)NULL)->id) == ID_SIZE, "id index ids must be the size of element ids");
+
+// Builds the id index of the list, which has none, from its elements.
+static void build_id_index(ListMM list) {
+    ListReader reader;
+    Node_ node;
+    id_index_create(list->file_mem, &list->index.ids, list->index.size);
+    FileCell cell = list->index.head;
+    reader_init(&reader, list->file_mem, list->index.size);
+    for (size_t position = 0; position < list->index.size; position++) {
+        reader_read(&reader, cell, &node);
+        id_index_add(list->file_mem, &list->index.ids, node.element.id, cell);
+        cell = node.next;
+    }
+}
+
+// Builds an index of the elements of the list by id, kept in the list file and
+// committed with every change to the list. Returns false if the list is
+// versioned, or its file was created before lists had id indexes.
+bool list_enable_id_index(ListMM list) {
+    write_lock(list);
+    bool enabled = !list->versioned && file_mem_info(list->file_mem).index_size >= (int)sizeof(ListMMIndex);
+    if (enabled && !has_id_index(list)) {
+        build_id_index(list);
+        commit(list);
+    }
+    unlock(list);
+    return enabled;
+}
+
+// Removes the id index of the list, if it has one, freeing its cells.
+void list_disable_id_index(ListMM list) {
+    write_lock(list);
+    if (has_id_index(list)) {
+        id_index_destroy(list->file_mem, &list->index.ids);
+        commit(list);
+    }
+    unlock(list);
+}
+
+// Returns true if the list has an id index.
+bool list_has_id_index(ListMM list) {
+    read_lock(list);
+    bool indexed = has_id_index(list);
+    unlock(list);
+    return indexed;
+}
+
+// Copies to element an element of the list whose id is the string pointed to
+// by id, and returns true, if there is one. Ids longer than an element's id
+// are never found. With an id index, this reads the chain of the id and the
+// node; otherwise, the list is walked.
+static bool find_by_id(ListMM list, const char* id, Element* element) {
+    ListReader reader;
+    Node_ node;
+    bool found = false;
+    if (strnlen(id, ID_SIZE + 1) > ID_SIZE) {
+        return false;
+    }
+    if (has_id_index(list)) {
+        FileCell cell = id_index_find(list->file_mem, &list->index.ids, id);
+        if (cell != NULL_CELL) {
+            read_cell(list->file_mem, cell, (void*)&node);
+            *element = node.element;
+            found = true;
+        }
+    } else {
+        FileCell cell = list->index.head;
+        reader_init(&reader, list->file_mem, list->index.size);
+        for (size_t position = 0; position < list->index.size && !found; position++) {
+            reader_read(&reader, cell, &node);
+            if (strncmp(node.element.id, id, ID_SIZE) == 0) {
+                *element = node.element;
+                found = true;
+            }
+            cell = node.next;
+        }
+    }
+    return found;
+}
+
+// Copies to element an element of the list whose id is the string pointed to
+// by id, and returns true, if there is one.
+bool list_find_by_id(ListMM list, const char* id, Element* element) {
+    uint64_t start = start_operation(list);
+    read_lock(list);
+    bool found = find_by_id(list, id, element);
+    unlock(list);
+    end_operation(list, LIST_OP_FIND_BY_ID, start);
+    return found;
+}
+
+// Rewrites the list in the file whose name is file_name so that its elements
+// are stored in order, in consecutive cells, with no free cells. The list is
+// copied to a scratch file, which then replaces the original.
+bool list_compact(const char* file_name) {
+    Node_ node;
+    char scratch_name[strlen(file_name) + sizeof(".compact")];
+    snprintf(scratch_name, sizeof(scratch_name), "%s.compact", file_name);
+    ListMM list = list_open(file_name);
+    if (list == NULL) {
+        return false;
+    }
+    remove(scratch_name);
+    ListMM compacted = list_create(scratch_name);
+    if (compacted == NULL) {
+        list_close(list);
+        return false;
+    }
+    Element* elements = malloc(COMPACT_BATCH * sizeof(Element));
+    FileCell cell = list->index.head;
+    size_t count = 0;
+    for (size_t position = 0; position < list->index.size; position++) {
+        read_cell(list->file_mem, cell, (void*)&node);
+        elements[count++] = node.element;
+        if (count == COMPACT_BATCH || position + 1 == list->index.size) {
+            append(compacted, elements, count);
+            count = 0;
+        }
+        cell = node.next;
+    }
+    free(elements);
+    if (has_id_index(list)) {
+        build_id_index(compacted);
+        commit(compacted);
+    }
+    list_close(compacted);
+    list_close(list);
+    if (rename(scratch_name, file_name) != 0) {
+        remove(scratch_name);
+        return false;
+    }
+    return true;
+}
+
+// Enables a write-back cache of capacity nodes for the list.
+// Returns false if the list already has a cache.
+bool list_enable_cache(ListMM list, size_t capacity) {
+    return file_mem_enable_cache(list->file_mem, capacity);
+}
+
+// Starts a background thread that writes cached nodes back to the
+// list file, so that insertions do not stall on large flushes.
+// Requires a cache.
+bool list_start_flusher(ListMM list, const FlusherConfig* config) {
+    return file_mem_start_flusher(list->file_mem, config);
+}
+
+// Writes every cached change of the list to the list file.
+void list_flush(ListMM list) {
+    file_mem_flush(list->file_mem);
+}
+
+// Returns the I/O counters of the list file.
+FileMemStats list_stats(ListMM list) {
+    return file_mem_stats(list->file_mem);
+}
+
+// Resets the I/O counters of the list file.
+void list_reset_stats(ListMM list) {
+    file_mem_reset_stats(list->file_mem);
+}
+
+// Starts recording every access to the list file in a trace file.
+bool list_start_trace(ListMM list, const char* trace_file_name) {
+    return file_mem_start_trace(list->file_mem, trace_file_name);
+}
+
+// Stops recording the accesses to the list file.
+bool list_stop_trace(ListMM list) {
+    return file_mem_stop_trace(list->file_mem);
+}
+
+// Records the latency of every ListOperation done on the list. Must be
+// called before the list is shared.
+bool list_enable_latency(ListMM list) {
+    if (list->latency != NULL) {
+        return false;
+    }
+    list->latency = malloc(LIST_OP_COUNT * sizeof(LatencyHistogram));
+    for (int op = 0; op < LIST_OP_COUNT; op++) {
+        list->latency[op] = latency_histogram_create();
+    }
+    return true;
+}
+
+// Returns the latencies recorded for the specified operation, or NULL if
+// they are not recorded.
+LatencyHistogram list_latency(ListMM list, ListOperation operation) {
+    return list->latency == NULL ? NULL : list->latency[operation];
+}
+
+// Returns the name of the specified operation.
+const char* list_operation_name(ListOperation operation) {
+    static const char* names[LIST_OP_COUNT] = {
+        "is_empty", "size", "insert_first", "insert_last", "insert", "find", "get_first",
+        "get_last", "get", "remove_first", "remove_last", "remove", "make_empty", "get_range", "get_many",
+        "set", "upsert", "remove_range", "remove_positions", "remove_if", "append", "for_each", "map", "fold",
+        "find_by_id", "cursor", "cursor_set", "cursor_next", "cursor_close"};
+    return operation < LIST_OP_COUNT ? names[operation] : "unknown";
+}
+
+// Prints the latency percentiles of every operation done on the list to out.
+void list_print_latency(ListMM list, FILE* out) {
+    for (int op = 0; list->latency != NULL && op < LIST_OP_COUNT; op++) {
+        if (latency_histogram_count(list->latency[op]) > 0) {
+            latency_histogram_print(list->latency[op], out, list_operation_name(op));
+        }
+    }
+}
+
+// Makes changes to the list copy the nodes they modify instead of
+// overwriting them, so that pinned versions stay intact.
+// Must be called while no version of the list is pinned. A list
+// opened as a FILE_MEM_SHARED_WRITER is versioned, and stays so.
+void list_set_versioned(ListMM list, bool versioned) {
+    write_lock(list);
+    versioned = versioned || list->shared;
+    if (versioned && has_id_index(list)) {
+        id_index_destroy(list->file_mem, &list->index.ids);
+        commit(list);
+    }
+    pthread_mutex_lock(&list->versions_lock);
+    list->versioned = versioned;
+    list->published = list->index;
+    pthread_mutex_unlock(&list->versions_lock);
+    if (!versioned) {
+        reclaim(list, UINT64_MAX);
+    }
+    unlock(list);
+}
+
+// Pins the latest version of a versioned list, or returns NULL
+// if the list is not versioned.
+ListVersion list_pin(ListMM list) {
+    pthread_mutex_lock(&list->versions_lock);
+    ListVersion version = NULL;
+    if (list->versioned) {
+        version = malloc(sizeof(struct ListVersion_));
+        version->list = list;
+        version->index = list->published;
+        version->epoch = list->epoch;
+        version->prev = NULL;
+        version->next = list->versions;
+        if (list->versions != NULL) {
+            list->versions->prev = version;
+        }
+        list->versions = version;
+    }
+    pthread_mutex_unlock(&list->versions_lock);
+    return version;
+}
+
+// Releases a pinned version. The nodes only it could reach are
+// freed by the next change to the list.
+void list_unpin(ListVersion version) {
+    ListMM list = version->list;
+    pthread_mutex_lock(&list->versions_lock);
+    if (version->prev != NULL) {
+        version->prev->next = version->next;
+    } else {
+        list->versions = version->next;
+    }
+    if (version->next != NULL) {
+        version->next->prev = version->prev;
+    }
+    pthread_mutex_unlock(&list->versions_lock);
+    free(version);
+}
+
+// Returns the number of elements in the pinned version.
+size_t list_version_size(ListVersion version) {
+    return version->index.size;
+}
+
+// Returns the element at the specified position in the pinned version.
+// Range of valid positions: 0, ..., list_version_size()-1.
+Element list_version_get(ListVersion version, size_t position) {
+    return get_in(version->list->file_mem, &version->index, position);
+}
+
+// Returns the position in the pinned version of the first occurrence
+// of the specified element, or -1 if it does not occur.
+int list_version_find(ListVersion version, bool (*equal)(Element*, Element*), Element* element) {
+    return find_in(version->list->file_mem, &version->index, equal, element);
+}
@@ -0,0 +1,122 @@
+#include "slow_disk.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define MB (1024.0 * 1024.0)
+
+typedef struct {
+    const SlowDiskConfig *config;
+    const StorageBackend *backend;
+    void *state;
+    long position;
+} _SlowDisk;
+
+// Charges delay_ns to the disk, by sleeping unless it is only simulated.
+static void delay(_SlowDisk *disk, uint64_t delay_ns) {
+    if (disk->config->stats != NULL) {
+        disk->config->stats->delay_ns += delay_ns;
+    }
+    if (!disk->config->simulate_only && delay_ns > 0) {
+        struct timespec duration = {(time_t)(delay_ns / 1000000000u), (long)(delay_ns % 1000000000u)};
+        while (nanosleep(&duration, &duration) != 0) {
+        }
+    }
+}
+
+// Counts and charges an access of size bytes at offset.
+static void charge_access(_SlowDisk *disk, long offset, size_t size, bool write) {
+    const SlowDiskConfig *config = disk->config;
+    uint64_t distance = offset > disk->position ? offset - disk->position : disk->position - offset;
+    uint64_t delay_ns = config->latency_ns + (uint64_t)(distance / MB * config->seek_ns_per_mb);
+    if (config->bandwidth_mb_s > 0) {
+        delay_ns += (uint64_t)(size / MB / config->bandwidth_mb_s * 1e9);
+    }
+    if (config->stats != NULL) {
+        SlowDiskStats *stats = config->stats;
+        if (write) {
+            stats->writes++;
+            stats->bytes_written += size;
+        } else {
+            stats->reads++;
+            stats->bytes_read += size;
+        }
+        if (distance > 0) {
+            stats->seeks++;
+            stats->seek_distance += distance;
+        }
+    }
+    disk->position = offset + (long)size;
+    delay(disk, delay_ns);
+}
+
+static void *slow_disk_open(const StorageBackend *backend, const char *file_name, bool create, bool read_only) {
+    const SlowDiskConfig *config = backend->params;
+    const StorageBackend *inner = config->backend != NULL ? config->backend : &stdio_backend;
+    void *state = inner->open(inner, file_name, create, read_only);
+    if (state == NULL) {
+        return NULL;
+    }
+    _SlowDisk *disk = malloc(sizeof(_SlowDisk));
+    disk->config = config;
+    disk->backend = inner;
+    disk->state = state;
+    disk->position = 0;
+    return disk;
+}
+
+static bool slow_disk_read_at(void *state, long offset, void *buffer, size_t size) {
+    _SlowDisk *disk = (_SlowDisk *)state;
+    charge_access(disk, offset, size, false);
+    return disk->backend->read_at(disk->state, offset, buffer, size);
+}
+
+static bool slow_disk_write_at(void *state, long offset, const void *buffer, size_t size) {
+    _SlowDisk *disk = (_SlowDisk *)state;
+    charge_access(disk, offset, size, true);
+    return disk->backend->write_at(disk->state, offset, buffer, size);
+}
+
+static bool slow_disk_grow(void *state, long size) {
+    _SlowDisk *disk = (_SlowDisk *)state;
+    return disk->backend->grow(disk->state, size);
+}
+
+static bool slow_disk_sync(void *state, bool durable) {
+    _SlowDisk *disk = (_SlowDisk *)state;
+    if (durable) {
+        if (disk->config->stats != NULL) {
+            disk->config->stats->syncs++;
+        }
+        delay(disk, disk->config->sync_ns);
+    }
+    return disk->backend->sync(disk->state, durable);
+}
+
+static void slow_disk_close(void *state) {
+    _SlowDisk *disk = (_SlowDisk *)state;
+    disk->backend->close(disk->state);
+    free(disk);
+}
+
+static int slow_disk_fd(void *state) {
+    _SlowDisk *disk = (_SlowDisk *)state;
+    return disk->backend->fd(disk->state);
+}
+
+// Charges the bytes that the kernel copied from the file like a read.
+static void slow_disk_copied(void *state, long offset, size_t size) {
+    _SlowDisk *disk = (_SlowDisk *)state;
+    charge_access(disk, offset, size, false);
+    if (disk->backend->copied != NULL) {
+        disk->backend->copied(disk->state, offset, size);
+    }
+}
+
+// Returns a backend that stores files through config->backend, or the stdio
+// backend if it is NULL, delaying every operation as config specifies.
+// config, like the backend, must remain valid while files use the backend.
+StorageBackend slow_disk_backend(const SlowDiskConfig *config) {
+    StorageBackend backend = {"slow_disk", slow_disk_open, slow_disk_read_at, slow_disk_write_at, slow_disk_grow,
+                              slow_disk_sync, slow_disk_close, slow_disk_fd, slow_disk_copied, config};
+    return backend;
+}
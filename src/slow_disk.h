@@ -0,0 +1,44 @@
+#ifndef SLOW_DISK_H
+#define SLOW_DISK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "storage_backend.h"
+
+// Operations done through a slow disk and the delay they were charged.
+typedef struct {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t syncs;
+    uint64_t seeks;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t seek_distance;
+    uint64_t delay_ns;
+} SlowDiskStats;
+
+// Costs charged by a slow disk on top of the backend it wraps. Each read or
+// write costs latency_ns, plus seek_ns_per_mb for every megabyte between its
+// offset and the end of the previous one, plus its size at bandwidth_mb_s,
+// if not zero. Copies made by the kernel from the file are charged as reads.
+// A durable sync costs sync_ns.
+typedef struct {
+    const StorageBackend *backend;
+    uint64_t latency_ns;
+    uint64_t seek_ns_per_mb;
+    double bandwidth_mb_s;
+    uint64_t sync_ns;
+    // If true, the delays are only added to stats instead of slept.
+    bool simulate_only;
+    // Where the operations are counted, or NULL. Not synchronized, so files
+    // used from different threads need different stats.
+    SlowDiskStats *stats;
+} SlowDiskConfig;
+
+// Returns a backend that stores files through config->backend, or the stdio
+// backend if it is NULL, delaying every operation as config specifies.
+// config, like the backend, must remain valid while files use the backend.
+StorageBackend slow_disk_backend(const SlowDiskConfig *config);
+
+#endif
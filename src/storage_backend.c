@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+#include "storage_backend.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MIN_MAPPING_SIZE (64 * 1024)
+
+// Returns true iff a file whose name is file_name exists.
+static bool file_exists(const char *file_name) {
+    struct stat status;
+    return stat(file_name, &status) == 0;
+}
+
+// Opens a file descriptor as a backend open operation would.
+static int open_fd(const char *file_name, bool create, bool read_only) {
+    if (file_name == NULL) {
+        return -1;
+    }
+    if (create) {
+        return open(file_name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    }
+    return open(file_name, read_only ? O_RDONLY : O_RDWR);
+}
+
+// stdio
+
+static void *stdio_open(const StorageBackend *backend, const char *file_name, bool create, bool read_only) {
+    (void)backend;
+    if (file_name == NULL || (create && file_exists(file_name))) {
+        return NULL;
+    }
+    FILE *file = fopen(file_name, create ? "w+" : read_only ? "r" : "r+");
+    if (file != NULL && read_only) {
+        // Every read must see what other processes have written since.
+        setvbuf(file, NULL, _IONBF, 0);
+    }
+    return file;
+}
+
+static bool stdio_read_at(void *state, long offset, void *buffer, size_t size) {
+    FILE *file = (FILE *)state;
+    fseek(file, offset, SEEK_SET);
+    size_t read = fread(buffer, 1, size, file);
+    memset((unsigned char *)buffer + read, 0, size - read);
+    return read == size;
+}
+
+static bool stdio_write_at(void *state, long offset, const void *buffer, size_t size) {
+    FILE *file = (FILE *)state;
+    fseek(file, offset, SEEK_SET);
+    return fwrite(buffer, 1, size, file) == size;
+}
+
+static bool stdio_grow(void *state, long size) {
+    (void)state;
+    (void)size;
+    return true;
+}
+
+static bool stdio_sync(void *state, bool durable) {
+    FILE *file = (FILE *)state;
+    return fflush(file) == 0 && (!durable || fsync(fileno(file)) == 0);
+}
+
+static void stdio_close(void *state) {
+    fclose((FILE *)state);
+}
+
+static int stdio_fd(void *state) {
+    return fileno((FILE *)state);
+}
+
+const StorageBackend stdio_backend = {
+    "stdio", stdio_open, stdio_read_at, stdio_write_at, stdio_grow, stdio_sync, stdio_close, stdio_fd, NULL, NULL};
+
+// pread
+
+typedef struct {
+    int fd;
+} _PreadFile;
+
+static void *pread_open(const StorageBackend *backend, const char *file_name, bool create, bool read_only) {
+    (void)backend;
+    int fd = open_fd(file_name, create, read_only);
+    if (fd < 0) {
+        return NULL;
+    }
+    _PreadFile *file = malloc(sizeof(_PreadFile));
+    file->fd = fd;
+    return file;
+}
+
+static bool pread_read_at(void *state, long offset, void *buffer, size_t size) {
+    _PreadFile *file = (_PreadFile *)state;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(file->fd, (unsigned char *)buffer + done, size - done, offset + (long)done);
+        if (n <= 0) {
+            memset((unsigned char *)buffer + done, 0, size - done);
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+static bool pread_write_at(void *state, long offset, const void *buffer, size_t size) {
+    _PreadFile *file = (_PreadFile *)state;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pwrite(file->fd, (const unsigned char *)buffer + done, size - done, offset + (long)done);
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+static bool pread_sync(void *state, bool durable) {
+    return !durable || fsync(((_PreadFile *)state)->fd) == 0;
+}
+
+static void pread_close(void *state) {
+    close(((_PreadFile *)state)->fd);
+    free(state);
+}
+
+static int pread_fd(void *state) {
+    return ((_PreadFile *)state)->fd;
+}
+
+const StorageBackend pread_backend = {
+    "pread", pread_open, pread_read_at, pread_write_at, stdio_grow, pread_sync, pread_close, pread_fd, NULL, NULL};
+
+// mmap
+
+// The mapping may be larger than the file as seen by the FileMem, which is
+// size bytes long; the file is truncated back to size when closed.
+typedef struct {
+    int fd;
+    bool read_only;
+    unsigned char *map;
+    size_t mapped;
+    size_t size;
+} _MappedFile;
+
+// Maps the first length bytes of the file, replacing any previous mapping.
+// Without mremap, which only Linux has, the file is mapped again, and the
+// previous mapping is dropped once the new one exists.
+static bool remap(_MappedFile *file, size_t length) {
+    int protection = file->read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    void *map;
+#ifdef __linux__
+    if (file->map == NULL) {
+        map = mmap(NULL, length, protection, MAP_SHARED, file->fd, 0);
+    } else {
+        map = mremap(file->map, file->mapped, length, MREMAP_MAYMOVE);
+    }
+#else
+    map = mmap(NULL, length, protection, MAP_SHARED, file->fd, 0);
+    if (map != MAP_FAILED && file->map != NULL) {
+        munmap(file->map, file->mapped);
+    }
+#endif
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    file->map = map;
+    file->mapped = length;
+    return true;
+}
+
+static void *mmap_open(const StorageBackend *backend, const char *file_name, bool create, bool read_only) {
+    (void)backend;
+    struct stat status;
+    int fd = open_fd(file_name, create, read_only);
+    if (fd < 0) {
+        return NULL;
+    }
+    _MappedFile *file = malloc(sizeof(_MappedFile));
+    file->fd = fd;
+    file->read_only = read_only;
+    file->map = NULL;
+    file->mapped = 0;
+    file->size = fstat(fd, &status) == 0 ? (size_t)status.st_size : 0;
+    if (file->size > 0 && !remap(file, file->size)) {
+        close(fd);
+        free(file);
+        return NULL;
+    }
+    return file;
+}
+
+static bool mmap_grow(void *state, long size) {
+    _MappedFile *file = (_MappedFile *)state;
+    if ((size_t)size <= file->size) {
+        return true;
+    }
+    if (file->read_only) {
+        return false;
+    }
+    if ((size_t)size > file->mapped) {
+        size_t length = file->mapped < MIN_MAPPING_SIZE ? MIN_MAPPING_SIZE : 2 * file->mapped;
+        if (length < (size_t)size) {
+            length = size;
+        }
+        if (ftruncate(file->fd, length) != 0 || !remap(file, length)) {
+            return false;
+        }
+    }
+    file->size = size;
+    return true;
+}
+
+static bool mmap_read_at(void *state, long offset, void *buffer, size_t size) {
+    _MappedFile *file = (_MappedFile *)state;
+    struct stat status;
+    if (file->read_only && offset + size > file->size && fstat(file->fd, &status) == 0 &&
+        (size_t)status.st_size > file->size && remap(file, status.st_size)) {
+        // The writer extended the file since it was mapped.
+        file->size = status.st_size;
+    }
+    size_t available = (size_t)offset >= file->size ? 0 : file->size - offset;
+    if (available > size) {
+        available = size;
+    }
+    if (available > 0) {
+        memcpy(buffer, file->map + offset, available);
+    }
+    memset((unsigned char *)buffer + available, 0, size - available);
+    return available == size;
+}
+
+static bool mmap_write_at(void *state, long offset, const void *buffer, size_t size) {
+    _MappedFile *file = (_MappedFile *)state;
+    if (!mmap_grow(state, offset + (long)size)) {
+        return false;
+    }
+    memcpy(file->map + offset, buffer, size);
+    return true;
+}
+
+static bool mmap_sync(void *state, bool durable) {
+    _MappedFile *file = (_MappedFile *)state;
+    return !durable || file->map == NULL || msync(file->map, file->size, MS_SYNC) == 0;
+}
+
+static void mmap_close(void *state) {
+    _MappedFile *file = (_MappedFile *)state;
+    if (file->map != NULL) {
+        munmap(file->map, file->mapped);
+    }
+    if (!file->read_only && ftruncate(file->fd, file->size) != 0) {
+        perror("mmap_close");
+    }
+    close(file->fd);
+    free(file);
+}
+
+static int mmap_fd(void *state) {
+    return ((_MappedFile *)state)->fd;
+}
+
+const StorageBackend mmap_backend = {
+    "mmap", mmap_open, mmap_read_at, mmap_write_at, mmap_grow, mmap_sync, mmap_close, mmap_fd, NULL, NULL};
+
+// memory
+
+typedef struct {
+    char *file_name;
+    bool read_only;
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} _MemoryFile;
+
+static bool memory_grow(void *state, long size) {
+    _MemoryFile *file = (_MemoryFile *)state;
+    if ((size_t)size > file->capacity) {
+        size_t capacity = file->capacity < MIN_MAPPING_SIZE ? MIN_MAPPING_SIZE : 2 * file->capacity;
+        if (capacity < (size_t)size) {
+            capacity = size;
+        }
+        unsigned char *data = realloc(file->data, capacity);
+        if (data == NULL) {
+            return false;
+        }
+        memset(data + file->capacity, 0, capacity - file->capacity);
+        file->data = data;
+        file->capacity = capacity;
+    }
+    if ((size_t)size > file->size) {
+        file->size = size;
+    }
+    return true;
+}
+
+static void *memory_open(const StorageBackend *backend, const char *file_name, bool create, bool read_only) {
+    (void)backend;
+    if (file_name == NULL && !create) {
+        return NULL;
+    }
+    _MemoryFile *file = calloc(1, sizeof(_MemoryFile));
+    file->read_only = read_only;
+    if (file_name != NULL) {
+        FILE *stream = fopen(file_name, "rb");
+        if ((stream != NULL) == create) {
+            if (stream != NULL) {
+                fclose(stream);
+            }
+            free(file);
+            return NULL;
+        }
+        if (create) {
+            // Claim the name until the contents are written back.
+            stream = fopen(file_name, "wb");
+            if (stream == NULL) {
+                free(file);
+                return NULL;
+            }
+            fclose(stream);
+        } else {
+            fseek(stream, 0L, SEEK_END);
+            long size = ftell(stream);
+            fseek(stream, 0L, SEEK_SET);
+            bool loaded = memory_grow(file, size) && fread(file->data, 1, size, stream) == (size_t)size;
+            fclose(stream);
+            if (!loaded) {
+                free(file->data);
+                free(file);
+                return NULL;
+            }
+        }
+        file->file_name = strdup(file_name);
+    }
+    return file;
+}
+
+static bool memory_read_at(void *state, long offset, void *buffer, size_t size) {
+    _MemoryFile *file = (_MemoryFile *)state;
+    size_t available = (size_t)offset >= file->size ? 0 : file->size - offset;
+    if (available > size) {
+        available = size;
+    }
+    if (available > 0) {
+        memcpy(buffer, file->data + offset, available);
+    }
+    memset((unsigned char *)buffer + available, 0, size - available);
+    return available == size;
+}
+
+static bool memory_write_at(void *state, long offset, const void *buffer, size_t size) {
+    _MemoryFile *file = (_MemoryFile *)state;
+    if (!memory_grow(state, offset + (long)size)) {
+        return false;
+    }
+    memcpy(file->data + offset, buffer, size);
+    return true;
+}
+
+// Writes the contents of a named memory file to the file with that name.
+static bool memory_write_back(_MemoryFile *file) {
+    if (file->file_name == NULL || file->read_only) {
+        return true;
+    }
+    FILE *stream = fopen(file->file_name, "wb");
+    if (stream == NULL) {
+        return false;
+    }
+    bool written = fwrite(file->data, 1, file->size, stream) == file->size;
+    return fclose(stream) == 0 && written;
+}
+
+static bool memory_sync(void *state, bool durable) {
+    return !durable || memory_write_back((_MemoryFile *)state);
+}
+
+static void memory_close(void *state) {
+    _MemoryFile *file = (_MemoryFile *)state;
+    if (!memory_write_back(file)) {
+        perror("memory_close");
+    }
+    free(file->file_name);
+    free(file->data);
+    free(file);
+}
+
+static int memory_fd(void *state) {
+    (void)state;
+    return -1;
+}
+
+const StorageBackend memory_backend = {
+    "memory", memory_open, memory_read_at, memory_write_at, memory_grow, memory_sync, memory_close, memory_fd, NULL,
+    NULL};
+
+// Returns the backend with the specified name, or NULL if there is none.
+const StorageBackend *find_storage_backend(const char *name) {
+    const StorageBackend *backends[] = {&stdio_backend, &pread_backend, &mmap_backend, &memory_backend};
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(backends[i]->name, name) == 0) {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
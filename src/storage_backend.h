@@ -0,0 +1,58 @@
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct StorageBackend StorageBackend;
+
+// Operations through which a FileMem stores its file. Each open file is
+// represented by a state returned by open and passed to the other operations.
+// Offsets and sizes are in bytes.
+struct StorageBackend {
+    // Name of the backend, as used by the tools.
+    const char *name;
+    // Opens the file whose name is file_name and returns its state, or NULL on
+    // failure. If create is true, the file must not exist and is created
+    // empty. A NULL file_name is only accepted by backends without a file.
+    void *(*open)(const StorageBackend *backend, const char *file_name, bool create, bool read_only);
+    // Reads size bytes at offset into buffer. Bytes past the end of the file
+    // read as zeros, in which case false is returned.
+    bool (*read_at)(void *state, long offset, void *buffer, size_t size);
+    // Writes size bytes at offset from buffer, extending the file if needed.
+    bool (*write_at)(void *state, long offset, const void *buffer, size_t size);
+    // Makes room for the file to be at least size bytes long.
+    bool (*grow)(void *state, long size);
+    // Makes the written data visible to other processes and, if durable is
+    // true, waits until it is on stable storage.
+    bool (*sync)(void *state, bool durable);
+    // Closes the file and releases its state.
+    void (*close)(void *state);
+    // Returns the file descriptor of the open file, or -1 if it has none.
+    int (*fd)(void *state);
+    // Accounts for size bytes at offset that the kernel copied from the file
+    // descriptor, bypassing read_at, or NULL if the backend does not count
+    // its reads.
+    void (*copied)(void *state, long offset, size_t size);
+    // Parameters of backends that are configured by the caller.
+    const void *params;
+};
+
+// Buffered stdio streams. The default backend.
+extern const StorageBackend stdio_backend;
+
+// Unbuffered positional reads and writes with pread and pwrite.
+extern const StorageBackend pread_backend;
+
+// A shared memory mapping of the file, grown geometrically.
+extern const StorageBackend mmap_backend;
+
+// The whole file in memory. An existing file is loaded when opened, and a
+// named file is written back when closed. Without a name, the file only
+// exists in memory.
+extern const StorageBackend memory_backend;
+
+// Returns the backend with the specified name, or NULL if there is none.
+const StorageBackend *find_storage_backend(const char *name);
+
+#endif
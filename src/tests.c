@@ -1,11 +1,18 @@
 #include "unity/unity.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
 #ifdef _WIN32
 #else
 #include <unistd.h>
 #endif
 
 #include "list_mm.h"
+#include "slow_disk.h"
+#include "trace.h"
 
 ListMM list;
 #define LIST_FILE_NAME "tests.lst"
@@ -170,6 +177,1209 @@ void test_make_empty() {
     TEST_ASSERT_EQUAL(0, list_size(list));
 }
 
+void test_reopen_keeps_elements() {
+    list_insert_last(list, &data[0]);
+    list_insert_last(list, &data[1]);
+    list_remove_first(list);
+    list_insert_last(list, &data[2]);
+    list_close(list);
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT_NOT_NULL(list);
+    TEST_ASSERT_EQUAL(2, list_size(list));
+    TEST_ASSERT_EQUAL(data[1].value, list_get_first(list).value);
+    TEST_ASSERT_EQUAL(data[2].value, list_get_last(list).value);
+}
+
+void test_open_falls_back_to_previous_superblock() {
+    list_insert_last(list, &data[0]);
+    list_insert_last(list, &data[1]);
+    list_close(list);
+    list = NULL;
+
+    // The creation commit went to slot 1, so the two inserts went to slots 0
+    // and 1. Tearing slot 1 must expose the commit with a single element.
+    FILE* file = fopen(LIST_FILE_NAME, "r+");
+    fseek(file, SUPERBLOCK_SIZE + 8, SEEK_SET);
+    fputc(0xff, file);
+    fclose(file);
+
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT_NOT_NULL(list);
+    TEST_ASSERT_EQUAL(1, list_size(list));
+    TEST_ASSERT_EQUAL(data[0].value, list_get_last(list).value);
+}
+
+void test_open_without_valid_superblock() {
+    list_close(list);
+    list = NULL;
+    FILE* file = fopen(LIST_FILE_NAME, "r+");
+    fputc(0xff, file);
+    fseek(file, SUPERBLOCK_SIZE, SEEK_SET);
+    fputc(0xff, file);
+    fclose(file);
+    TEST_ASSERT_NULL(list_open(LIST_FILE_NAME));
+}
+
+// Stores value in the int at offset in the control info of both superblocks
+// of the list file, and seals them again, as a writer with a bug would.
+void damage_control_info(long offset, int value) {
+    FILE* file = fopen(LIST_FILE_NAME, "r+");
+    for (long slot = 0; slot < 2 * SUPERBLOCK_SIZE; slot += SUPERBLOCK_SIZE) {
+        unsigned char superblock[SUPERBLOCK_SIZE];
+        fseek(file, slot, SEEK_SET);
+        TEST_ASSERT_EQUAL(SUPERBLOCK_SIZE, fread(superblock, 1, SUPERBLOCK_SIZE, file));
+        // The control info follows the magic, the version and the sequence.
+        memcpy(superblock + 16 + offset, &value, sizeof(int));
+        file_mem_seal_superblock(superblock);
+        fseek(file, slot, SEEK_SET);
+        fwrite(superblock, 1, SUPERBLOCK_SIZE, file);
+    }
+    fclose(file);
+}
+
+// The control info holds the index size, the cell size, the number of cells
+// and the head of the free list, at these offsets.
+void test_open_rejects_cells_too_small_for_a_reference() {
+    list_close(list);
+    list = NULL;
+    damage_control_info(4, 2);
+    TEST_ASSERT_NULL(open_file(LIST_FILE_NAME));
+}
+
+void test_open_rejects_free_list_past_the_last_cell() {
+    list_insert_last(list, &data[0]);
+    list_close(list);
+    list = NULL;
+    damage_control_info(12, 1000);
+    TEST_ASSERT_NULL(open_file(LIST_FILE_NAME));
+}
+
+void test_open_rejects_files_of_other_layouts() {
+    list_close(list);
+    list = NULL;
+    delete_list_file();
+    // An index larger than that of lists.
+    close_file(create_file(LIST_FILE_NAME, 256, sizeof(Element)));
+    TEST_ASSERT_NULL(list_open(LIST_FILE_NAME));
+    delete_list_file();
+    // Cells smaller than the nodes of lists.
+    close_file(create_file(LIST_FILE_NAME, 0, 4));
+    TEST_ASSERT_NULL(list_open(LIST_FILE_NAME));
+}
+
+void test_cache_keeps_elements_after_reopen() {
+    TEST_ASSERT(list_enable_cache(list, 4));
+    TEST_ASSERT_FALSE(list_enable_cache(list, 4));
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_EQUAL(data[3].value, list_get(list, 3).value);
+    list_remove_first(list);
+    list_close(list);
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT_EQUAL(6, list_size(list));
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(data[i + 1].value, list_get(list, i).value);
+    }
+}
+
+void test_flusher_writes_dirty_cells_back() {
+    FlusherConfig config = {.dirty_ratio = 0.5, .max_age_ms = 1, .interval_ms = 1};
+    FileMem file_mem = create_file("tests.mem", 0, sizeof(Element));
+    TEST_ASSERT(file_mem_enable_cache(file_mem, 16));
+    TEST_ASSERT(file_mem_start_flusher(file_mem, &config));
+    for (int i = 0; i < 7; i++) {
+        write_cell(file_mem, new_cell(file_mem), &data[i]);
+    }
+    for (int i = 0; i < 1000 && file_mem_dirty_cells(file_mem) > 0; i++) {
+        usleep(1000);
+    }
+    TEST_ASSERT_EQUAL(0, file_mem_dirty_cells(file_mem));
+    close_file(file_mem);
+    unlink("tests.mem");
+}
+
+volatile bool writes_fail = false;
+
+// Writes through the stdio backend, unless writes_fail is set.
+bool write_unless_failing(void* state, long offset, const void* buffer, size_t size) {
+    return !writes_fail && stdio_backend.write_at(state, offset, buffer, size);
+}
+
+void test_flusher_keeps_cells_whose_write_failed_dirty() {
+    FlusherConfig config = {.dirty_ratio = 0.5, .max_age_ms = 0, .interval_ms = 1};
+    StorageBackend backend = stdio_backend;
+    backend.write_at = write_unless_failing;
+    FileMemOptions options = {.backend = &backend};
+    Element element;
+    remove("tests.mem");
+    FileMem file_mem = create_file_with_options("tests.mem", 0, sizeof(Element), &options);
+    TEST_ASSERT(file_mem_enable_cache(file_mem, 16));
+    for (int i = 0; i < 7; i++) {
+        write_cell(file_mem, new_cell(file_mem), &data[i]);
+    }
+    writes_fail = true;
+    TEST_ASSERT(file_mem_start_flusher(file_mem, &config));
+    for (int i = 0; i < 1000 && file_mem_stats(file_mem).failed_writes == 0; i++) {
+        usleep(1000);
+    }
+    TEST_ASSERT(file_mem_stats(file_mem).failed_writes > 0);
+    TEST_ASSERT_EQUAL(7, file_mem_dirty_cells(file_mem));
+    writes_fail = false;
+    for (int i = 0; i < 1000 && file_mem_dirty_cells(file_mem) > 0; i++) {
+        usleep(1000);
+    }
+    TEST_ASSERT_EQUAL(0, file_mem_dirty_cells(file_mem));
+    close_file(file_mem);
+    file_mem = open_file("tests.mem");
+    for (int i = 0; i < 7; i++) {
+        read_cell(file_mem, i + 1, &element);
+        TEST_ASSERT_EQUAL(data[i].value, element.value);
+    }
+    close_file(file_mem);
+    remove("tests.mem");
+}
+
+void test_cache_evicts_clean_cells_first() {
+    Element element;
+    FileMem file_mem = create_file("tests.mem", 0, sizeof(Element));
+    for (int i = 0; i < 5; i++) {
+        write_cell(file_mem, new_cell(file_mem), &data[i]);
+    }
+    TEST_ASSERT(file_mem_enable_cache(file_mem, 4));
+    write_cell(file_mem, 1, &data[5]);
+    for (FileCell file_cell = 2; file_cell <= 5; file_cell++) {
+        read_cell(file_mem, file_cell, &element);
+    }
+    // The miss on cell 5 evicted cell 2 rather than the dirty cell 1.
+    TEST_ASSERT_EQUAL(1, file_mem_dirty_cells(file_mem));
+    uint64_t reads = file_mem_stats(file_mem).storage_reads;
+    read_cell(file_mem, 1, &element);
+    TEST_ASSERT_EQUAL(data[5].value, element.value);
+    TEST_ASSERT_EQUAL(reads, file_mem_stats(file_mem).storage_reads);
+    close_file(file_mem);
+    unlink("tests.mem");
+}
+
+void test_flusher_keeps_cells_written_during_a_batch() {
+    FlusherConfig config = {.dirty_ratio = 0.25, .max_age_ms = 0, .interval_ms = 1};
+    Element element = data[0];
+    FileMem file_mem = create_file("tests.mem", 0, sizeof(Element));
+    for (int i = 0; i < 64; i++) {
+        write_cell(file_mem, new_cell(file_mem), &element);
+    }
+    TEST_ASSERT(file_mem_enable_cache(file_mem, 16));
+    TEST_ASSERT(file_mem_start_flusher(file_mem, &config));
+    for (int i = 0; i < 20000; i++) {
+        element.value = i;
+        write_cell(file_mem, 1 + (i * 7) % 64, &element);
+    }
+    close_file(file_mem);
+    file_mem = open_file("tests.mem");
+    for (int i = 20000 - 64; i < 20000; i++) {
+        read_cell(file_mem, 1 + (i * 7) % 64, &element);
+        TEST_ASSERT_EQUAL(i, element.value);
+    }
+    close_file(file_mem);
+    unlink("tests.mem");
+}
+
+// Reads the list from a thread while it is being extended.
+void* read_concurrently(void* argument) {
+    (void)argument;
+    for (int i = 0; i < 200; i++) {
+        size_t size = list_size(list);
+        if (size > 0 && list_get(list, size - 1).value > 7) {
+            return (void*)1;
+        }
+        if (list_find(list, equal_elements, &data[0]) > 0) {
+            return (void*)1;
+        }
+    }
+    return NULL;
+}
+
+void test_thread_safe_readers_and_writer() {
+    pthread_t readers[4];
+    list_set_thread_safe(list, true);
+    list_insert_last(list, &data[0]);
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&readers[i], NULL, read_concurrently, NULL);
+    }
+    for (int i = 0; i < 100; i++) {
+        list_insert_last(list, &data[1 + i % 6]);
+    }
+    for (int i = 0; i < 4; i++) {
+        void* failed;
+        pthread_join(readers[i], &failed);
+        TEST_ASSERT_NULL(failed);
+    }
+    TEST_ASSERT_EQUAL(101, list_size(list));
+}
+
+void test_shared_reader_sees_snapshot_until_refresh() {
+    FileMemOptions writer_options = {.mode = FILE_MEM_SHARED_WRITER};
+    FileMemOptions reader_options = {.mode = FILE_MEM_SHARED_READER};
+    list_destroy(list);
+    delete_list_file();
+    list = list_create_with_options(LIST_FILE_NAME, &writer_options);
+    TEST_ASSERT_NOT_NULL(list);
+    TEST_ASSERT_NULL(list_open_with_options(LIST_FILE_NAME, &writer_options));
+    list_insert_last(list, &data[0]);
+
+    ListMM reader = list_open_with_options(LIST_FILE_NAME, &reader_options);
+    TEST_ASSERT_NOT_NULL(reader);
+    TEST_ASSERT_EQUAL(1, list_size(reader));
+    list_insert_last(list, &data[1]);
+    list_insert_last(list, &data[2]);
+    TEST_ASSERT_EQUAL(1, list_size(reader));
+    TEST_ASSERT_EQUAL(data[0].value, list_get_last(reader).value);
+
+    TEST_ASSERT(list_refresh(reader));
+    TEST_ASSERT_FALSE(list_refresh(reader));
+    TEST_ASSERT_EQUAL(3, list_size(reader));
+    TEST_ASSERT_EQUAL(data[2].value, list_get_last(reader).value);
+    list_close(reader);
+}
+
+// Checks that the list holds the values, in order.
+static void assert_values(ListMM checked, const int* values, size_t count) {
+    TEST_ASSERT_EQUAL(count, list_size(checked));
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(values[i], list_get(checked, i).value);
+    }
+}
+
+void test_shared_writer_keeps_cells_readers_reach() {
+    FileMemOptions writer_options = {.mode = FILE_MEM_SHARED_WRITER};
+    FileMemOptions reader_options = {.mode = FILE_MEM_SHARED_READER};
+    list_destroy(list);
+    delete_list_file();
+    list = list_create_with_options(LIST_FILE_NAME, &writer_options);
+    for (int i = 0; i < 3; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    ListMM reader = list_open_with_options(LIST_FILE_NAME, &reader_options);
+    TEST_ASSERT_NOT_NULL(reader);
+
+    // The removed head is still reachable from the reader's snapshot.
+    list_remove_first(list);
+    list_insert_last(list, &data[3]);
+    TEST_ASSERT_EQUAL(4, list_info(list).num_cells);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+    int before[] = {1, 2, 3};
+    assert_values(reader, before, 3);
+
+    // Once the reader moves on, the cell is reused.
+    TEST_ASSERT(list_refresh(reader));
+    list_insert_last(list, &data[4]);
+    TEST_ASSERT_EQUAL(4, list_info(list).num_cells);
+    TEST_ASSERT(list_refresh(reader));
+    int after[] = {2, 3, 4, 5};
+    assert_values(reader, after, 4);
+    list_close(reader);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+void test_shared_reader_does_not_see_changes_in_place() {
+    FileMemOptions writer_options = {.mode = FILE_MEM_SHARED_WRITER};
+    FileMemOptions reader_options = {.mode = FILE_MEM_SHARED_READER};
+    list_destroy(list);
+    delete_list_file();
+    list = list_create_with_options(LIST_FILE_NAME, &writer_options);
+    for (int i = 0; i < 4; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    ListMM reader = list_open_with_options(LIST_FILE_NAME, &reader_options);
+    TEST_ASSERT_NOT_NULL(reader);
+    list_set(list, 2, &data[6]);
+    list_insert(list, &data[5], 1);
+    ListCursor cursor = list_cursor(list);
+    TEST_ASSERT(list_cursor_set(cursor, &data[4]));
+    list_cursor_close(cursor);
+    int before[] = {1, 2, 3, 4};
+    assert_values(reader, before, 4);
+    TEST_ASSERT(list_refresh(reader));
+    int after[] = {5, 6, 2, 7, 4};
+    assert_values(reader, after, 5);
+    list_close(reader);
+}
+
+void test_shared_writer_takes_back_cells_retired_when_closed() {
+    FileMemOptions writer_options = {.mode = FILE_MEM_SHARED_WRITER};
+    FileMemOptions reader_options = {.mode = FILE_MEM_SHARED_READER};
+    list_destroy(list);
+    delete_list_file();
+    list = list_create_with_options(LIST_FILE_NAME, &writer_options);
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    ListMM reader = list_open_with_options(LIST_FILE_NAME, &reader_options);
+    for (int i = 0; i < 5; i++) {
+        list_remove_first(list);
+    }
+    list_close(list);
+
+    // The cells the reader reaches are still retired after reopening.
+    list = list_open_with_options(LIST_FILE_NAME, &writer_options);
+    TEST_ASSERT_NOT_NULL(list);
+    TEST_ASSERT_EQUAL(5, list_info(list).retired_cells);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+    TEST_ASSERT_EQUAL(7, list_size(reader));
+    TEST_ASSERT_EQUAL(data[6].value, list_get_last(reader).value);
+    list_close(reader);
+
+    // Once the reader is gone, they are reused.
+    size_t num_cells = list_info(list).num_cells;
+    for (int i = 0; i < 5; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_EQUAL(num_cells, list_info(list).num_cells);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+void test_pinned_version_survives_changes() {
+    TEST_ASSERT_NULL(list_pin(list));
+    list_set_versioned(list, true);
+    for (int i = 0; i < 4; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    ListVersion version = list_pin(list);
+    TEST_ASSERT_NOT_NULL(version);
+
+    list_remove(list, 1);
+    list_insert(list, &data[5], 1);
+    list_remove_last(list);
+    list_remove_first(list);
+    list_insert_last(list, &data[6]);
+    list_insert_first(list, &data[4]);
+    TEST_ASSERT_EQUAL(4, list_size(list));
+    TEST_ASSERT_EQUAL(data[4].value, list_get(list, 0).value);
+    TEST_ASSERT_EQUAL(data[5].value, list_get(list, 1).value);
+    TEST_ASSERT_EQUAL(data[2].value, list_get(list, 2).value);
+    TEST_ASSERT_EQUAL(data[6].value, list_get(list, 3).value);
+
+    TEST_ASSERT_EQUAL(4, list_version_size(version));
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(data[i].value, list_version_get(version, i).value);
+    }
+    TEST_ASSERT_EQUAL(3, list_version_find(version, equal_elements, &data[3]));
+    list_unpin(version);
+
+    // Once the version is released, its nodes can be freed.
+    list_insert_last(list, &data[0]);
+    list_make_empty(list);
+    list_close(list);
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT_EQUAL(0, list_size(list));
+}
+
+void test_backends_store_and_reload() {
+    const StorageBackend* backends[] = {&stdio_backend, &pread_backend, &mmap_backend, &memory_backend};
+    list_destroy(list);
+    list = NULL;
+    for (int b = 0; b < 4; b++) {
+        FileMemOptions options = {.backend = backends[b]};
+        delete_list_file();
+        ListMM other_list = list_create_with_options(LIST_FILE_NAME, &options);
+        TEST_ASSERT_NOT_NULL(other_list);
+        TEST_ASSERT_NULL(list_create_with_options(LIST_FILE_NAME, &options));
+        for (int i = 0; i < 7; i++) {
+            list_insert(other_list, &data[i], i / 2);
+        }
+        list_remove(other_list, 3);
+        list_close(other_list);
+
+        other_list = list_open_with_options(LIST_FILE_NAME, &options);
+        TEST_ASSERT_NOT_NULL(other_list);
+        TEST_ASSERT_EQUAL(6, list_size(other_list));
+        int expected[] = {2, 4, 6, 5, 3, 1};
+        for (int i = 0; i < 6; i++) {
+            TEST_ASSERT_EQUAL(expected[i], list_get(other_list, i).value);
+        }
+        list_destroy(other_list);
+
+        // Every backend writes the same file format.
+        other_list = list_open(LIST_FILE_NAME);
+        TEST_ASSERT_EQUAL(6, list_size(other_list));
+        TEST_ASSERT_EQUAL(1, list_get_last(other_list).value);
+        list_destroy(other_list);
+    }
+    TEST_ASSERT_EQUAL_PTR(&mmap_backend, find_storage_backend("mmap"));
+    TEST_ASSERT_NULL(find_storage_backend("tape"));
+}
+
+void test_in_memory_list_dump() {
+    ListMM memory_list = list_create_in_memory();
+    TEST_ASSERT_NOT_NULL(memory_list);
+    for (int i = 0; i < 7; i++) {
+        list_insert_first(memory_list, &data[i]);
+    }
+    list_remove(memory_list, 2);
+    TEST_ASSERT_EQUAL(6, list_size(memory_list));
+    TEST_ASSERT_FALSE(list_dump(memory_list, LIST_FILE_NAME));
+    list_destroy(list);
+    delete_list_file();
+    TEST_ASSERT(list_dump(memory_list, LIST_FILE_NAME));
+    list_insert_last(memory_list, &data[0]);
+    list_destroy(memory_list);
+
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT_NOT_NULL(list);
+    TEST_ASSERT_EQUAL(6, list_size(list));
+    TEST_ASSERT_EQUAL(7, list_get_first(list).value);
+    TEST_ASSERT_EQUAL(4, list_get(list, 2).value);
+    TEST_ASSERT_EQUAL(1, list_get_last(list).value);
+}
+
+void test_clone_is_independent_copy() {
+    FileMemOptions options = {.backend = &mmap_backend};
+    list_destroy(list);
+    delete_list_file();
+    list = list_create_with_options(LIST_FILE_NAME, &options);
+    TEST_ASSERT(list_enable_cache(list, 4));
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    unlink("tests.copy");
+    ListMM copy = list_clone(list, "tests.copy");
+    TEST_ASSERT_NOT_NULL(copy);
+    TEST_ASSERT_NULL(list_clone(list, "tests.copy"));
+    list_remove_first(copy);
+    list_insert_last(list, &data[0]);
+    TEST_ASSERT_EQUAL(6, list_size(copy));
+    TEST_ASSERT_EQUAL(2, list_get_first(copy).value);
+    TEST_ASSERT_EQUAL(8, list_size(list));
+    TEST_ASSERT_EQUAL(0, list_verify(copy, NULL));
+    list_close(copy);
+    unlink("tests.copy");
+}
+
+void test_slow_disk_counts_and_charges_operations() {
+    SlowDiskStats stats = {0};
+    SlowDiskConfig config = {.latency_ns = 1000, .seek_ns_per_mb = 1000000, .bandwidth_mb_s = 100,
+                             .simulate_only = true, .stats = &stats};
+    StorageBackend backend = slow_disk_backend(&config);
+    FileMemOptions options = {.backend = &backend};
+    list_destroy(list);
+    delete_list_file();
+    list = list_create_with_options(LIST_FILE_NAME, &options);
+    TEST_ASSERT_NOT_NULL(list);
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT(stats.writes > 0);
+    uint64_t reads = stats.reads;
+    TEST_ASSERT_EQUAL(4, list_get(list, 3).value);
+    TEST_ASSERT(stats.reads > reads);
+    TEST_ASSERT(stats.seeks > 0);
+    TEST_ASSERT(stats.delay_ns >= 1000 * (stats.reads + stats.writes));
+    list_close(list);
+
+    list = list_open_with_options(LIST_FILE_NAME, &options);
+    TEST_ASSERT_EQUAL(7, list_size(list));
+    TEST_ASSERT_EQUAL(7, list_get_last(list).value);
+    list_destroy(list);
+    list = NULL;
+}
+
+void test_slow_disk_charges_cells_sent_by_the_kernel() {
+    SlowDiskStats stats = {0};
+    SlowDiskConfig config = {.latency_ns = 1000, .simulate_only = true, .stats = &stats};
+    StorageBackend backend = slow_disk_backend(&config);
+    FileMemOptions options = {.backend = &backend};
+    unsigned char cells[8][16] = {{0}};
+    remove("tests.send");
+    FileMem file_mem = create_file_with_options("tests.send", 0, 16, &options);
+    TEST_ASSERT_NOT_NULL(file_mem);
+    write_cells(file_mem, new_cells(file_mem, 8), 8, cells);
+    file_mem_flush(file_mem);
+    SlowDiskStats before = stats;
+    FILE* output = tmpfile();
+    TEST_ASSERT(file_mem_send_cells(file_mem, 1, 8, fileno(output)));
+    TEST_ASSERT(stats.reads > before.reads);
+    TEST_ASSERT_EQUAL(before.bytes_read + sizeof(cells), stats.bytes_read);
+    TEST_ASSERT(stats.delay_ns > before.delay_ns);
+    fclose(output);
+    close_file(file_mem);
+    remove("tests.send");
+}
+
+void test_cells_are_synced_before_the_superblock() {
+    SlowDiskStats stats = {0};
+    SlowDiskConfig config = {.simulate_only = true, .stats = &stats};
+    StorageBackend backend = slow_disk_backend(&config);
+    FileMemOptions options = {.backend = &backend};
+    char index[4] = {0};
+    remove("tests.mem");
+    FileMem file_mem = create_file_with_options("tests.mem", sizeof(index), sizeof(Element), &options);
+    write_cell(file_mem, new_cell(file_mem), &data[0]);
+    uint64_t syncs = stats.syncs;
+    uint64_t writes = stats.writes;
+    write_index(file_mem, index);
+    TEST_ASSERT_EQUAL(syncs + 1, stats.syncs);
+    TEST_ASSERT_EQUAL(writes + 1, stats.writes);
+    close_file(file_mem);
+    remove("tests.mem");
+}
+
+void test_stats_count_operation_io() {
+    for (int i = 0; i < 3; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    list_reset_stats(list);
+    TEST_ASSERT_EQUAL(0, list_stats(list).cell_reads);
+
+    list_get(list, 1);
+    FileMemStats stats = list_stats(list);
+    TEST_ASSERT_EQUAL(2, stats.cell_reads);
+    TEST_ASSERT_EQUAL(0, stats.cell_writes);
+    TEST_ASSERT_EQUAL(2, stats.storage_reads);
+    TEST_ASSERT_EQUAL(2 * (sizeof(Element) + sizeof(FileCell)), stats.bytes_read);
+    TEST_ASSERT_EQUAL(0, stats.index_writes);
+
+    list_reset_stats(list);
+    list_remove_first(list);
+    list_insert_first(list, &data[0]);
+    stats = list_stats(list);
+    TEST_ASSERT_EQUAL(1, stats.free_list_pops);
+    TEST_ASSERT_EQUAL(0, stats.file_extensions);
+    TEST_ASSERT_EQUAL(2, stats.index_writes);
+    TEST_ASSERT_EQUAL(2, stats.control_info_writes);
+    list_insert_last(list, &data[3]);
+    TEST_ASSERT_EQUAL(1, list_stats(list).file_extensions);
+}
+
+void test_latency_histograms_record_operations() {
+    LatencyHistogram histogram = latency_histogram_create();
+    for (uint64_t value = 1; value <= 1000; value++) {
+        latency_histogram_record(histogram, value * 1000);
+    }
+    TEST_ASSERT_EQUAL(1000, latency_histogram_count(histogram));
+    TEST_ASSERT_EQUAL(1000000, latency_histogram_max(histogram));
+    TEST_ASSERT_UINT64_WITHIN(500000 / 32, 500000, latency_histogram_percentile(histogram, 50));
+    TEST_ASSERT_UINT64_WITHIN(990000 / 32, 990000, latency_histogram_percentile(histogram, 99));
+    TEST_ASSERT_EQUAL(1000000, latency_histogram_percentile(histogram, 100));
+    latency_histogram_destroy(histogram);
+
+    TEST_ASSERT_NULL(list_latency(list, LIST_OP_GET));
+    TEST_ASSERT(list_enable_latency(list));
+    TEST_ASSERT_FALSE(list_enable_latency(list));
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    list_get(list, 3);
+    list_get(list, 4);
+    TEST_ASSERT_EQUAL(7, latency_histogram_count(list_latency(list, LIST_OP_INSERT_LAST)));
+    TEST_ASSERT_EQUAL(2, latency_histogram_count(list_latency(list, LIST_OP_GET)));
+    TEST_ASSERT_EQUAL(0, latency_histogram_count(list_latency(list, LIST_OP_REMOVE)));
+    TEST_ASSERT(latency_histogram_percentile(list_latency(list, LIST_OP_GET), 99) > 0);
+    TEST_ASSERT_EQUAL_STRING("insert_last", list_operation_name(LIST_OP_INSERT_LAST));
+
+    Element range[2];
+    Element element;
+    list_get_range(list, 1, 2, range);
+    list_set(list, 0, &data[0]);
+    list_append(list, data, 2);
+    list_remove_range(list, 7, 2);
+    list_find_by_id(list, "c", &element);
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_GET_RANGE)));
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_SET)));
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_APPEND)));
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_REMOVE_RANGE)));
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_FIND_BY_ID)));
+    TEST_ASSERT_EQUAL_STRING("find_by_id", list_operation_name(LIST_OP_FIND_BY_ID));
+
+    ListCursor cursor = list_cursor(list);
+    list_cursor_next(cursor);
+    list_cursor_set(cursor, &data[0]);
+    list_cursor_close(cursor);
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_CURSOR)));
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_CURSOR_NEXT)));
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_CURSOR_SET)));
+    TEST_ASSERT_EQUAL(1, latency_histogram_count(list_latency(list, LIST_OP_CURSOR_CLOSE)));
+    TEST_ASSERT_EQUAL_STRING("cursor_close", list_operation_name(LIST_OP_CURSOR_CLOSE));
+}
+
+void test_trace_records_accesses() {
+    TEST_ASSERT(list_start_trace(list, "tests.trace"));
+    TEST_ASSERT_FALSE(list_start_trace(list, "tests.trace"));
+    list_insert_first(list, &data[0]);
+    list_get_first(list);
+    list_remove_first(list);
+    TEST_ASSERT(list_stop_trace(list));
+
+    TraceOp expected[] = {TRACE_NEW_CELL,   TRACE_WRITE_CELL, TRACE_WRITE_INDEX, TRACE_WRITE_CONTROL_INFO,
+                          TRACE_READ_CELL,  TRACE_READ_CELL,  TRACE_FREE_CELL,   TRACE_WRITE_INDEX,
+                          TRACE_WRITE_CONTROL_INFO};
+    TraceReader reader = trace_reader_open("tests.trace");
+    TEST_ASSERT_NOT_NULL(reader);
+    TEST_ASSERT_EQUAL(sizeof(Element) + sizeof(FileCell), trace_cell_size(reader));
+    TraceRecord record;
+    uint64_t time_ns = 0;
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        TEST_ASSERT(trace_read(reader, &record));
+        TEST_ASSERT_EQUAL_STRING(trace_op_name(expected[i]), trace_op_name(record.op));
+        TEST_ASSERT(record.time_ns >= time_ns);
+        time_ns = record.time_ns;
+        if (record.op == TRACE_NEW_CELL || record.op == TRACE_READ_CELL || record.op == TRACE_FREE_CELL) {
+            TEST_ASSERT_EQUAL(1, record.cell);
+        }
+    }
+    TEST_ASSERT_FALSE(trace_read(reader, &record));
+    trace_reader_close(reader);
+    unlink("tests.trace");
+}
+
+bool sum_values(const Element* element, void* ctx) {
+    *(int*)ctx += element->value;
+    return element->value < 5;
+}
+
+void test_append_for_each_and_compact() {
+    list_insert_first(list, &data[0]);
+    list_append(list, data + 1, 6);
+    TEST_ASSERT_EQUAL(7, list_size(list));
+    TEST_ASSERT_EQUAL(7, list_get_last(list).value);
+    int sum = 0;
+    list_for_each(list, sum_values, &sum);
+    TEST_ASSERT_EQUAL(1 + 2 + 3 + 4 + 5, sum);
+
+    list_remove(list, 1);
+    list_remove(list, 3);
+    list_insert_first(list, &data[1]);
+    ListMMInfo info = list_info(list);
+    TEST_ASSERT_EQUAL(6, info.size);
+    TEST_ASSERT_EQUAL(7, info.num_cells);
+    TEST_ASSERT_EQUAL(1, info.free_cells);
+    TEST_ASSERT(info.out_of_order > 0);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+    list_close(list);
+
+    TEST_ASSERT(list_compact(LIST_FILE_NAME));
+    list = list_open(LIST_FILE_NAME);
+    info = list_info(list);
+    TEST_ASSERT_EQUAL(6, info.num_cells);
+    TEST_ASSERT_EQUAL(0, info.free_cells);
+    TEST_ASSERT_EQUAL(0, info.out_of_order);
+    int expected[] = {2, 1, 3, 4, 6, 7};
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(expected[i], list_get(list, i).value);
+    }
+    TEST_ASSERT_EQUAL(7, list_get_last(list).value);
+}
+
+void test_verify_finds_damaged_links() {
+    unsigned char node[sizeof(Element) + sizeof(FileCell)];
+    FileCell cycle = 2;
+    for (int i = 0; i < 4; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+    list_close(list);
+
+    FileMem file_mem = open_file(LIST_FILE_NAME);
+    read_cell(file_mem, 3, node);
+    memcpy(node + sizeof(Element), &cycle, sizeof(FileCell));
+    write_cell(file_mem, 3, node);
+    close_file(file_mem);
+
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT(list_verify(list, NULL) > 0);
+}
+
+void test_snapshot_export_and_import() {
+    for (int i = 0; i < 7; i++) {
+        list_insert(list, &data[i], i / 2);
+    }
+    list_remove(list, 2);
+    int fd = open("tests.snapshot", O_RDWR | O_CREAT | O_TRUNC, 0666);
+    TEST_ASSERT(list_export_snapshot(list, fd));
+    TEST_ASSERT_EQUAL(20 + 6 * sizeof(Element), lseek(fd, 0, SEEK_CUR));
+
+    lseek(fd, 0, SEEK_SET);
+    TEST_ASSERT_NULL(list_import_snapshot(LIST_FILE_NAME, fd));
+    unlink("tests.copy");
+    lseek(fd, 0, SEEK_SET);
+    ListMM copy = list_import_snapshot("tests.copy", fd);
+    TEST_ASSERT_NOT_NULL(copy);
+    TEST_ASSERT_EQUAL(6, list_size(copy));
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(list_get(list, i).value, list_get(copy, i).value);
+        TEST_ASSERT_EQUAL_STRING(list_get(list, i).id, list_get(copy, i).id);
+    }
+    ListMMInfo info = list_info(copy);
+    TEST_ASSERT_EQUAL(6, info.num_cells);
+    TEST_ASSERT_EQUAL(0, info.out_of_order);
+    TEST_ASSERT_EQUAL(0, list_verify(copy, NULL));
+    list_close(copy);
+
+    // A truncated snapshot leaves no list behind.
+    unlink("tests.copy");
+    TEST_ASSERT_EQUAL(0, ftruncate(fd, 20 + 5 * sizeof(Element)));
+    lseek(fd, 0, SEEK_SET);
+    TEST_ASSERT_NULL(list_import_snapshot("tests.copy", fd));
+    TEST_ASSERT_NULL(list_open("tests.copy"));
+    close(fd);
+    unlink("tests.snapshot");
+}
+
+void test_sequential_list_exports_cells() {
+    for (int i = 0; i < 5; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT(list_info(list).sequential);
+    int fd = open("tests.snapshot", O_RDWR | O_CREAT | O_TRUNC, 0666);
+    TEST_ASSERT(list_export_snapshot(list, fd));
+    TEST_ASSERT_EQUAL(20 + 5 * (sizeof(Element) + sizeof(FileCell)), lseek(fd, 0, SEEK_CUR));
+
+    // The cells are copied to a pipe as well, and read back as elements.
+    int pipe_fds[2];
+    TEST_ASSERT_EQUAL(0, pipe(pipe_fds));
+    TEST_ASSERT(list_export_snapshot(list, pipe_fds[1]));
+    close(pipe_fds[1]);
+    unlink("tests.copy");
+    ListMM copy = list_import_snapshot("tests.copy", pipe_fds[0]);
+    close(pipe_fds[0]);
+    TEST_ASSERT_NOT_NULL(copy);
+    TEST_ASSERT_EQUAL(5, list_size(copy));
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(data[i].value, list_get(copy, i).value);
+    }
+    TEST_ASSERT(list_info(copy).sequential);
+    TEST_ASSERT_EQUAL(0, list_verify(copy, NULL));
+    list_close(copy);
+    unlink("tests.copy");
+
+    // Cells without a file descriptor are written from a buffer.
+    ListMM memory = list_create_in_memory();
+    list_insert_last(memory, &data[0]);
+    lseek(fd, 0, SEEK_SET);
+    TEST_ASSERT(list_export_snapshot(memory, fd));
+    TEST_ASSERT_EQUAL(20 + sizeof(Element) + sizeof(FileCell), lseek(fd, 0, SEEK_CUR));
+    list_destroy(memory);
+
+    // Inserting in the middle moves the list out of order for good.
+    list_insert(list, &data[5], 2);
+    list_remove(list, 2);
+    TEST_ASSERT_FALSE(list_info(list).sequential);
+    list_close(list);
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT_FALSE(list_info(list).sequential);
+    list_make_empty(list);
+    TEST_ASSERT(list_info(list).sequential);
+    close(fd);
+    unlink("tests.snapshot");
+}
+
+void test_get_range_reads_consecutive_cells_together() {
+    Element out[8];
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    list_reset_stats(list);
+    TEST_ASSERT_EQUAL(5, list_get_range(list, 2, 8, out));
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(data[i + 2].value, out[i].value);
+    }
+    TEST_ASSERT_EQUAL(3, list_stats(list).storage_reads);
+    TEST_ASSERT_EQUAL(0, list_get_range(list, 7, 1, out));
+
+    // Out of order, the list is walked from its head.
+    list_insert(list, &data[6], 1);
+    TEST_ASSERT_EQUAL(3, list_get_range(list, 1, 3, out));
+    TEST_ASSERT_EQUAL(7, out[0].value);
+    TEST_ASSERT_EQUAL(2, out[1].value);
+    TEST_ASSERT_EQUAL(3, out[2].value);
+}
+
+void test_get_many_returns_elements_in_requested_order() {
+    size_t positions[] = {5, 0, 9, 3, 5};
+    Element out[5] = {{0}};
+    for (int i = 0; i < 7; i++) {
+        list_insert(list, &data[i], i / 2);
+    }
+    TEST_ASSERT_EQUAL(4, list_get_many(list, positions, 5, out));
+    for (int i = 0; i < 5; i++) {
+        if (positions[i] < 7) {
+            TEST_ASSERT_EQUAL(list_get(list, positions[i]).value, out[i].value);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, out[2].value);
+
+    list_close(list);
+    TEST_ASSERT(list_compact(LIST_FILE_NAME));
+    list = list_open(LIST_FILE_NAME);
+    Element compacted[5] = {{0}};
+    TEST_ASSERT_EQUAL(4, list_get_many(list, positions, 5, compacted));
+    TEST_ASSERT_EQUAL_MEMORY(out, compacted, sizeof(out));
+}
+
+void test_remove_range_and_positions() {
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_EQUAL(2, list_remove_range(list, 5, 4));
+    TEST_ASSERT(list_info(list).sequential);
+    TEST_ASSERT_EQUAL(2, list_remove_range(list, 1, 2));
+    assert_values(list, (int[]){1, 4, 5}, 3);
+    TEST_ASSERT_EQUAL(0, list_remove_range(list, 3, 1));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+
+    size_t positions[] = {4, 0, 9, 2, 4};
+    for (int i = 0; i < 3; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_EQUAL(3, list_remove_positions(list, positions, 5));
+    assert_values(list, (int[]){4, 1, 3}, 3);
+    TEST_ASSERT_EQUAL(3, list_get_last(list).value);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+    TEST_ASSERT_EQUAL(1, list_remove_range(list, 0, 1));
+    TEST_ASSERT_EQUAL(2, list_remove_positions(list, (size_t[]){1, 0}, 2));
+    TEST_ASSERT(list_is_empty(list));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+void test_versioned_range_removal_keeps_pinned_version() {
+    list_set_versioned(list, true);
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    ListVersion version = list_pin(list);
+    TEST_ASSERT_EQUAL(2, list_remove_range(list, 2, 2));
+    TEST_ASSERT_EQUAL(2, list_remove_positions(list, (size_t[]){4, 1}, 2));
+    assert_values(list, (int[]){1, 5, 6}, 3);
+    TEST_ASSERT_EQUAL(6, list_get_last(list).value);
+    for (int i = 0; i < 7; i++) {
+        TEST_ASSERT_EQUAL(data[i].value, list_version_get(version, i).value);
+    }
+    list_unpin(version);
+    list_insert_last(list, &data[0]);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+// Returns true if the value of element is a multiple of *ctx.
+static bool is_multiple(const Element* element, void* ctx) {
+    return element->value % *(int*)ctx == 0;
+}
+
+void test_remove_if_removes_matching_elements() {
+    int divisor = 2;
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_EQUAL(3, list_remove_if(list, is_multiple, &divisor));
+    assert_values(list, (int[]){1, 3, 5, 7}, 4);
+    TEST_ASSERT_EQUAL(7, list_get_last(list).value);
+    TEST_ASSERT_FALSE(list_info(list).sequential);
+    TEST_ASSERT_EQUAL(0, list_remove_if(list, is_multiple, &divisor));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+
+    list_set_versioned(list, true);
+    ListVersion version = list_pin(list);
+    divisor = 7;
+    TEST_ASSERT_EQUAL(1, list_remove_if(list, is_multiple, &divisor));
+    assert_values(list, (int[]){1, 3, 5}, 3);
+    TEST_ASSERT_EQUAL(4, list_version_size(version));
+    TEST_ASSERT_EQUAL(7, list_version_get(version, 3).value);
+    list_unpin(version);
+    divisor = 1;
+    TEST_ASSERT_EQUAL(3, list_remove_if(list, is_multiple, &divisor));
+    TEST_ASSERT(list_is_empty(list));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+// Multiplies the value of element by *ctx if it is odd.
+static bool scale_odd(Element* element, void* ctx) {
+    if (element->value % 2 == 0) {
+        return false;
+    }
+    element->value *= *(int*)ctx;
+    return true;
+}
+
+// Negates the value of element if it is above *ctx.
+static bool negate_above(Element* element, void* ctx) {
+    if (element->value <= *(int*)ctx) {
+        return false;
+    }
+    element->value = -element->value;
+    return true;
+}
+
+// Adds the value of element to acc.
+static long long add_value(long long acc, const Element* element, void* ctx) {
+    (void)ctx;
+    return acc + element->value;
+}
+
+void test_map_and_fold() {
+    int factor = 10;
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_EQUAL(28, list_fold(list, 0, add_value, NULL));
+    list_map(list, scale_odd, &factor);
+    assert_values(list, (int[]){10, 2, 30, 4, 50, 6, 70}, 7);
+    TEST_ASSERT(list_info(list).sequential);
+    list_close(list);
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT_EQUAL(172, list_fold(list, 0, add_value, NULL));
+
+    list_set_versioned(list, true);
+    ListVersion version = list_pin(list);
+    int threshold = 20;
+    list_map(list, negate_above, &threshold);
+    TEST_ASSERT_EQUAL(-128, list_fold(list, 0, add_value, NULL));
+    TEST_ASSERT_EQUAL(-70, list_get_last(list).value);
+    TEST_ASSERT_EQUAL(70, list_version_get(version, 6).value);
+    list_unpin(version);
+    list_insert_last(list, &data[0]);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+void test_set_rewrites_a_single_cell() {
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    list_reset_stats(list);
+    list_set(list, 3, &data[0]);
+    FileMemStats stats = list_stats(list);
+    TEST_ASSERT_EQUAL(0, stats.cell_reads);
+    TEST_ASSERT_EQUAL(1, stats.cell_writes);
+    TEST_ASSERT_EQUAL(0, stats.index_writes);
+
+    list_insert(list, &data[6], 1);
+    list_set(list, 4, &data[1]);
+    list_set(list, 7, &data[2]);
+    list_set(list, 8, &data[3]);
+    assert_values(list, (int[]){1, 7, 2, 3, 2, 5, 6, 3}, 8);
+    TEST_ASSERT_EQUAL(3, list_get_last(list).value);
+
+    ListCursor cursor = list_cursor(list);
+    for (int i = 0; list_cursor_valid(cursor); i++, list_cursor_next(cursor)) {
+        Element element = list_cursor_get(cursor);
+        element.value += i * 100;
+        TEST_ASSERT(list_cursor_set(cursor, &element));
+    }
+    TEST_ASSERT_FALSE(list_cursor_set(cursor, &data[0]));
+    list_cursor_close(cursor);
+    assert_values(list, (int[]){1, 107, 202, 303, 402, 505, 606, 703}, 8);
+
+    list_set_versioned(list, true);
+    ListVersion version = list_pin(list);
+    list_set(list, 2, &data[0]);
+    cursor = list_cursor(list);
+    list_cursor_next(cursor);
+    list_cursor_set(cursor, &data[0]);
+    list_cursor_next(cursor);
+    TEST_ASSERT_EQUAL(1, list_cursor_get(cursor).value);
+    list_cursor_close(cursor);
+    assert_values(list, (int[]){1, 1, 1, 303, 402, 505, 606, 703}, 8);
+    TEST_ASSERT_EQUAL(107, list_version_get(version, 1).value);
+    TEST_ASSERT_EQUAL(202, list_version_get(version, 2).value);
+    list_unpin(version);
+    list_insert_last(list, &data[0]);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+void test_cursor_copies_versioned_list_once() {
+    for (int i = 0; i < 40; i++) {
+        Element element = {.value = i};
+        list_insert_last(list, &element);
+    }
+    list_set_versioned(list, true);
+    ListVersion version = list_pin(list);
+    list_reset_stats(list);
+    ListCursor cursor = list_cursor(list);
+    for (; list_cursor_valid(cursor); list_cursor_next(cursor)) {
+        Element element = list_cursor_get(cursor);
+        if (element.value % 3 == 1) {
+            element.value += 100;
+            list_cursor_set(cursor, &element);
+            list_cursor_set(cursor, &element);
+        }
+    }
+    list_cursor_close(cursor);
+    // Each node is read by the walk, and those not replaced once more.
+    TEST_ASSERT(list_stats(list).cell_reads <= 80);
+    TEST_ASSERT_EQUAL(1, list_stats(list).index_writes);
+    for (int i = 0; i < 40; i++) {
+        TEST_ASSERT_EQUAL(i % 3 == 1 ? i + 100 : i, list_get(list, i).value);
+        TEST_ASSERT_EQUAL(i, list_version_get(version, i).value);
+    }
+    TEST_ASSERT_EQUAL(39, list_get_last(list).value);
+    list_unpin(version);
+    list_insert_last(list, &data[0]);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+
+    cursor = list_read_cursor(list);
+    TEST_ASSERT_EQUAL(0, list_cursor_get(cursor).value);
+    list_cursor_next(cursor);
+    TEST_ASSERT_EQUAL(101, list_cursor_get(cursor).value);
+    TEST_ASSERT_FALSE(list_cursor_set(cursor, &data[0]));
+    TEST_ASSERT_EQUAL(101, list_cursor_get(cursor).value);
+    list_cursor_close(cursor);
+    TEST_ASSERT_EQUAL(101, list_get(list, 1).value);
+}
+
+// Returns true if a and b have the same id.
+static bool same_id(const Element* a, const Element* b) {
+    return strncmp(a->id, b->id, sizeof(a->id)) == 0;
+}
+
+void test_upsert_updates_or_appends() {
+    Element element = {.value = 20, .id = "b"};
+    TEST_ASSERT_FALSE(list_upsert(list, same_id, &data[0]));
+    TEST_ASSERT_FALSE(list_upsert(list, same_id, &data[1]));
+    TEST_ASSERT_TRUE(list_upsert(list, same_id, &element));
+    TEST_ASSERT_FALSE(list_upsert(list, same_id, &data[2]));
+    assert_values(list, (int[]){1, 20, 3}, 3);
+    TEST_ASSERT_EQUAL(3, list_get_last(list).value);
+    TEST_ASSERT(list_info(list).sequential);
+
+    list_set_versioned(list, true);
+    ListVersion version = list_pin(list);
+    element.value = 200;
+    list_reset_stats(list);
+    TEST_ASSERT_TRUE(list_upsert(list, same_id, &element));
+    // The walk reads ahead at most the 3 nodes; only the 2 nodes up to the
+    // match are read again to be copied.
+    TEST_ASSERT(list_stats(list).cell_reads <= 3 + 2);
+    TEST_ASSERT_FALSE(list_upsert(list, same_id, &data[3]));
+    Element last = {.value = 40, .id = "d"};
+    TEST_ASSERT_TRUE(list_upsert(list, same_id, &last));
+    TEST_ASSERT_EQUAL(40, list_get_last(list).value);
+    last.value = 4;
+    TEST_ASSERT_TRUE(list_upsert(list, same_id, &last));
+    assert_values(list, (int[]){1, 200, 3, 4}, 4);
+    TEST_ASSERT_EQUAL(20, list_version_get(version, 1).value);
+    list_unpin(version);
+    list_insert_last(list, &data[0]);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+// Renames element to the id "x" followed by its value.
+static bool rename_element(Element* element, void* ctx) {
+    (void)ctx;
+    snprintf(element->id, sizeof(element->id), "x%d", element->value);
+    return true;
+}
+
+void test_id_index_tracks_changes() {
+    Element element;
+    for (int i = 0; i < 7; i++) {
+        list_insert_last(list, &data[i]);
+    }
+    TEST_ASSERT_FALSE(list_has_id_index(list));
+    TEST_ASSERT(list_find_by_id(list, "c", &element));
+    TEST_ASSERT_EQUAL(3, element.value);
+    TEST_ASSERT(list_enable_id_index(list));
+    TEST_ASSERT(list_has_id_index(list));
+    list_reset_stats(list);
+    TEST_ASSERT(list_find_by_id(list, "g", &element));
+    TEST_ASSERT_EQUAL(7, element.value);
+    TEST_ASSERT(list_stats(list).cell_reads <= 3);
+    TEST_ASSERT_FALSE(list_find_by_id(list, "z", &element));
+
+    // Enough insertions to grow the table.
+    for (int i = 0; i < 300; i++) {
+        Element numbered = {.value = 100 + i};
+        snprintf(numbered.id, sizeof(numbered.id), "n%d", i);
+        list_insert(list, &numbered, 3);
+    }
+    TEST_ASSERT(list_find_by_id(list, "n123", &element));
+    TEST_ASSERT_EQUAL(223, element.value);
+    TEST_ASSERT_EQUAL(307, list_size(list));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+
+    list_remove_first(list);
+    list_remove_last(list);
+    list_remove(list, 3);
+    TEST_ASSERT_EQUAL(100, list_remove_range(list, 2, 100));
+    int divisor = 3;
+    list_remove_if(list, is_multiple, &divisor);
+    TEST_ASSERT_FALSE(list_find_by_id(list, "a", &element));
+    TEST_ASSERT_FALSE(list_find_by_id(list, "g", &element));
+    for (int i = 0; i < 300; i++) {
+        Element numbered = {.value = 100 + i};
+        snprintf(numbered.id, sizeof(numbered.id), "n%d", i);
+        bool present = list_find(list, equal_elements, &numbered) >= 0;
+        TEST_ASSERT_EQUAL(present, list_find_by_id(list, numbered.id, &element));
+        TEST_ASSERT(!present || element.value == numbered.value);
+    }
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+
+    Element renamed = {.value = 1, .id = "r"};
+    list_set(list, 0, &renamed);
+    TEST_ASSERT(list_find_by_id(list, "r", &element));
+    TEST_ASSERT_FALSE(list_upsert(list, same_id, &data[0]));
+    TEST_ASSERT(list_find_by_id(list, "a", &element));
+    list_map(list, rename_element, NULL);
+    TEST_ASSERT_FALSE(list_find_by_id(list, "a", &element));
+    TEST_ASSERT(list_find_by_id(list, "x1", &element));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+
+    // The index is in the file, and survives reopening and compaction.
+    size_t size = list_size(list);
+    list_close(list);
+    TEST_ASSERT(list_compact(LIST_FILE_NAME));
+    list = list_open(LIST_FILE_NAME);
+    TEST_ASSERT(list_has_id_index(list));
+    TEST_ASSERT_EQUAL(size, list_size(list));
+    TEST_ASSERT(list_find_by_id(list, "x1", &element));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+    TEST_ASSERT(list_info(list).id_index_cells > size);
+
+    list_make_empty(list);
+    TEST_ASSERT(list_has_id_index(list));
+    TEST_ASSERT_FALSE(list_find_by_id(list, "x1", &element));
+    list_insert_first(list, &data[1]);
+    TEST_ASSERT(list_find_by_id(list, "b", &element));
+    list_disable_id_index(list);
+    TEST_ASSERT_EQUAL(0, list_info(list).id_index_cells);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+    TEST_ASSERT(list_enable_id_index(list));
+    list_set_versioned(list, true);
+    TEST_ASSERT_FALSE(list_has_id_index(list));
+    TEST_ASSERT_FALSE(list_enable_id_index(list));
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
+void test_find_by_id_rejects_long_ids() {
+    Element element;
+    Element full = {.value = 8, .id = "12345678"};
+    list_insert_last(list, &full);
+    for (int indexed = 0; indexed < 2; indexed++) {
+        if (indexed) {
+            TEST_ASSERT(list_enable_id_index(list));
+        }
+        TEST_ASSERT(list_find_by_id(list, "12345678", &element));
+        TEST_ASSERT_EQUAL(8, element.value);
+        TEST_ASSERT_FALSE(list_find_by_id(list, "123456789", &element));
+    }
+}
+
+void test_id_index_keeps_the_latest_duplicate_when_growing() {
+    Element element;
+    Element first = {.value = 1, .id = "dup"};
+    Element second = {.value = 2, .id = "dup"};
+    TEST_ASSERT(list_enable_id_index(list));
+    list_insert_last(list, &first);
+    list_insert_last(list, &second);
+    TEST_ASSERT(list_find_by_id(list, "dup", &element));
+    TEST_ASSERT_EQUAL(2, element.value);
+    // Enough insertions to grow the table.
+    for (int i = 0; i < 300; i++) {
+        Element numbered = {.value = 100 + i};
+        snprintf(numbered.id, sizeof(numbered.id), "n%d", i);
+        list_insert_last(list, &numbered);
+    }
+    TEST_ASSERT(list_find_by_id(list, "dup", &element));
+    TEST_ASSERT_EQUAL(2, element.value);
+    TEST_ASSERT_EQUAL(0, list_verify(list, NULL));
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_create_with_existing_file);
@@ -186,5 +1396,50 @@ int main(void) {
     RUN_TEST(test_remove_last);
     RUN_TEST(test_remove);
     RUN_TEST(test_make_empty);
+    RUN_TEST(test_reopen_keeps_elements);
+    RUN_TEST(test_open_falls_back_to_previous_superblock);
+    RUN_TEST(test_open_without_valid_superblock);
+    RUN_TEST(test_open_rejects_cells_too_small_for_a_reference);
+    RUN_TEST(test_open_rejects_free_list_past_the_last_cell);
+    RUN_TEST(test_open_rejects_files_of_other_layouts);
+    RUN_TEST(test_cache_keeps_elements_after_reopen);
+    RUN_TEST(test_flusher_writes_dirty_cells_back);
+    RUN_TEST(test_flusher_keeps_cells_whose_write_failed_dirty);
+    RUN_TEST(test_cache_evicts_clean_cells_first);
+    RUN_TEST(test_flusher_keeps_cells_written_during_a_batch);
+    RUN_TEST(test_thread_safe_readers_and_writer);
+    RUN_TEST(test_shared_reader_sees_snapshot_until_refresh);
+#ifdef __linux__
+    // Elsewhere, a writer does not see the readers in its own process.
+    RUN_TEST(test_shared_writer_keeps_cells_readers_reach);
+    RUN_TEST(test_shared_reader_does_not_see_changes_in_place);
+    RUN_TEST(test_shared_writer_takes_back_cells_retired_when_closed);
+#endif
+    RUN_TEST(test_pinned_version_survives_changes);
+    RUN_TEST(test_backends_store_and_reload);
+    RUN_TEST(test_in_memory_list_dump);
+    RUN_TEST(test_clone_is_independent_copy);
+    RUN_TEST(test_slow_disk_counts_and_charges_operations);
+    RUN_TEST(test_slow_disk_charges_cells_sent_by_the_kernel);
+    RUN_TEST(test_cells_are_synced_before_the_superblock);
+    RUN_TEST(test_stats_count_operation_io);
+    RUN_TEST(test_latency_histograms_record_operations);
+    RUN_TEST(test_trace_records_accesses);
+    RUN_TEST(test_append_for_each_and_compact);
+    RUN_TEST(test_verify_finds_damaged_links);
+    RUN_TEST(test_snapshot_export_and_import);
+    RUN_TEST(test_sequential_list_exports_cells);
+    RUN_TEST(test_get_range_reads_consecutive_cells_together);
+    RUN_TEST(test_get_many_returns_elements_in_requested_order);
+    RUN_TEST(test_remove_range_and_positions);
+    RUN_TEST(test_versioned_range_removal_keeps_pinned_version);
+    RUN_TEST(test_remove_if_removes_matching_elements);
+    RUN_TEST(test_map_and_fold);
+    RUN_TEST(test_set_rewrites_a_single_cell);
+    RUN_TEST(test_cursor_copies_versioned_list_once);
+    RUN_TEST(test_upsert_updates_or_appends);
+    RUN_TEST(test_id_index_tracks_changes);
+    RUN_TEST(test_find_by_id_rejects_long_ids);
+    RUN_TEST(test_id_index_keeps_the_latest_duplicate_when_growing);
     return UNITY_END();
 }
\ No newline at end of file
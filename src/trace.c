@@ -0,0 +1,177 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A trace starts with a header of four 32-bit little-endian words: the magic
+// number, the version, the index size and the cell size. Each record follows
+// as a byte with the access, the cell reference and the nanoseconds since the
+// previous record, both as unsigned LEB128 varints.
+#define TRACE_MAGIC 0x544d4d4cu
+#define TRACE_VERSION 1u
+#define TRACE_BUFFER_SIZE (64 * 1024)
+#define MAX_RECORD_SIZE (1 + 5 + 10)
+
+struct _TraceWriter {
+    FILE *file;
+    uint64_t last_ns;
+    bool failed;
+    size_t used;
+    unsigned char buffer[TRACE_BUFFER_SIZE];
+};
+
+struct _TraceReader {
+    FILE *file;
+    int index_size;
+    int cell_size;
+    uint64_t time_ns;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void put_word(unsigned char *data, uint32_t word) {
+    for (int i = 0; i < 4; i++) {
+        data[i] = (unsigned char)(word >> (8 * i));
+    }
+}
+
+static uint32_t get_word(const unsigned char *data) {
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// Appends value to the buffer of the writer as a varint.
+static void put_varint(TraceWriter writer, uint64_t value) {
+    while (value >= 0x80) {
+        writer->buffer[writer->used++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    writer->buffer[writer->used++] = (unsigned char)value;
+}
+
+// Reads a varint from the trace into value. Returns false at the end of it.
+static bool get_varint(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) {
+            return false;
+        }
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void flush_buffer(TraceWriter writer) {
+    if (writer->used > 0 && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) {
+        writer->failed = true;
+    }
+    writer->used = 0;
+}
+
+// Creates a trace file for a FileMem whose index has index_size bytes and
+// cells have cell_size bytes.
+TraceWriter trace_writer_open(const char *file_name, int index_size, int cell_size) {
+    unsigned char header[16];
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL) {
+        return NULL;
+    }
+    TraceWriter writer = malloc(sizeof(struct _TraceWriter));
+    writer->file = file;
+    writer->failed = false;
+    writer->used = 0;
+    writer->last_ns = now_ns();
+    put_word(header, TRACE_MAGIC);
+    put_word(header + 4, TRACE_VERSION);
+    put_word(header + 8, (uint32_t)index_size);
+    put_word(header + 12, (uint32_t)cell_size);
+    memcpy(writer->buffer, header, sizeof(header));
+    writer->used = sizeof(header);
+    return writer;
+}
+
+// Records an access to the cell whose reference is cell.
+void trace_write(TraceWriter writer, TraceOp op, FileCell cell) {
+    if (writer->used + MAX_RECORD_SIZE > TRACE_BUFFER_SIZE) {
+        flush_buffer(writer);
+    }
+    uint64_t now = now_ns();
+    writer->buffer[writer->used++] = (unsigned char)op;
+    put_varint(writer, (uint32_t)cell);
+    put_varint(writer, now - writer->last_ns);
+    writer->last_ns = now;
+}
+
+// Writes the buffered records and closes the trace.
+bool trace_writer_close(TraceWriter writer) {
+    flush_buffer(writer);
+    bool written = !writer->failed && fclose(writer->file) == 0;
+    free(writer);
+    return written;
+}
+
+// Opens the trace file whose name is the string pointed to by file_name.
+TraceReader trace_reader_open(const char *file_name) {
+    unsigned char header[16];
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || get_word(header) != TRACE_MAGIC ||
+        get_word(header + 4) != TRACE_VERSION) {
+        fclose(file);
+        return NULL;
+    }
+    TraceReader reader = malloc(sizeof(struct _TraceReader));
+    reader->file = file;
+    reader->index_size = (int)get_word(header + 8);
+    reader->cell_size = (int)get_word(header + 12);
+    reader->time_ns = 0;
+    return reader;
+}
+
+// Returns the size of the index of the traced FileMem.
+int trace_index_size(TraceReader reader) {
+    return reader->index_size;
+}
+
+// Returns the size of the cells of the traced FileMem.
+int trace_cell_size(TraceReader reader) {
+    return reader->cell_size;
+}
+
+// Reads the next record of the trace into record.
+bool trace_read(TraceReader reader, TraceRecord *record) {
+    uint64_t cell, delta;
+    int op = fgetc(reader->file);
+    if (op == EOF || op >= TRACE_OP_COUNT || !get_varint(reader->file, &cell) ||
+        !get_varint(reader->file, &delta)) {
+        return false;
+    }
+    reader->time_ns += delta;
+    record->op = (TraceOp)op;
+    record->cell = (FileCell)cell;
+    record->time_ns = reader->time_ns;
+    return true;
+}
+
+// Closes the specified trace.
+void trace_reader_close(TraceReader reader) {
+    fclose(reader->file);
+    free(reader);
+}
+
+// Returns the name of the specified access.
+const char *trace_op_name(TraceOp op) {
+    static const char *names[TRACE_OP_COUNT] = {"read_cell",  "write_cell", "new_cell",          "free_cell",
+                                                "read_index", "write_index", "write_control_info"};
+    return op < TRACE_OP_COUNT ? names[op] : "unknown";
+}
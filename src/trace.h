@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory_manager.h"
+
+// Accesses recorded in a trace.
+typedef enum {
+    TRACE_READ_CELL,
+    TRACE_WRITE_CELL,
+    TRACE_NEW_CELL,
+    TRACE_FREE_CELL,
+    TRACE_READ_INDEX,
+    TRACE_WRITE_INDEX,
+    // A superblock, holding the control info and the index, written to the
+    // slot recorded as the cell.
+    TRACE_WRITE_CONTROL_INFO,
+    TRACE_OP_COUNT
+} TraceOp;
+
+// An access and the time at which it happened, in nanoseconds since the
+// trace started.
+typedef struct {
+    TraceOp op;
+    FileCell cell;
+    uint64_t time_ns;
+} TraceRecord;
+
+typedef struct _TraceWriter *TraceWriter;
+typedef struct _TraceReader *TraceReader;
+
+// Creates a trace file whose name is the string pointed to by file_name, for
+// a FileMem whose index has index_size bytes and cells have cell_size bytes.
+// Returns NULL if the file could not be created.
+TraceWriter trace_writer_open(const char *file_name, int index_size, int cell_size);
+
+// Records an access to the cell whose reference is cell, which is ignored by
+// the accesses to the index.
+void trace_write(TraceWriter writer, TraceOp op, FileCell cell);
+
+// Writes the buffered records and closes the trace. Returns false if the
+// trace could not be completely written.
+bool trace_writer_close(TraceWriter writer);
+
+// Opens the trace file whose name is the string pointed to by file_name, or
+// returns NULL if it is not a trace.
+TraceReader trace_reader_open(const char *file_name);
+
+// Returns the size of the index and of the cells of the traced FileMem.
+int trace_index_size(TraceReader reader);
+int trace_cell_size(TraceReader reader);
+
+// Reads the next record of the trace into record. Returns false at the end
+// of the trace.
+bool trace_read(TraceReader reader, TraceRecord *record);
+
+// Closes the specified trace.
+void trace_reader_close(TraceReader reader);
+
+// Returns the name of the specified access.
+const char *trace_op_name(TraceOp op);
+
+#endif
@@ -0,0 +1,293 @@
+#include "workload.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Generator of zipfian ranks, after Gray et al., "Quickly generating
+// billion-record synthetic databases". The number of items may grow between
+// draws; zeta is extended incrementally.
+typedef struct {
+    double theta;
+    double alpha;
+    double zeta2;
+    double zetan;
+    size_t items;
+    double eta;
+} _Zipfian;
+
+typedef struct {
+    const WorkloadConfig *config;
+    uint64_t random;
+    _Zipfian zipfian;
+    double total_weight;
+    size_t size;
+    int next_key;
+} _Workload;
+
+// Returns whether an operation can be run by a workload.
+static bool runnable(ListOperation operation) {
+    return operation < LIST_OP_MAKE_EMPTY || operation == LIST_OP_SET || operation == LIST_OP_UPSERT ||
+           operation == LIST_OP_FIND_BY_ID;
+}
+
+// Fills config with a mix named name.
+bool workload_preset(WorkloadConfig *config, const char *name) {
+    memset(config->weights, 0, sizeof(config->weights));
+    if (strcmp(name, "read-mostly") == 0) {
+        config->weights[LIST_OP_GET] = 95;
+        config->weights[LIST_OP_INSERT] = 5;
+    } else if (strcmp(name, "read-insert") == 0) {
+        config->weights[LIST_OP_GET] = 50;
+        config->weights[LIST_OP_INSERT] = 50;
+    } else if (strcmp(name, "queue") == 0) {
+        config->weights[LIST_OP_INSERT_LAST] = 50;
+        config->weights[LIST_OP_REMOVE_FIRST] = 50;
+    } else if (strcmp(name, "scan") == 0) {
+        config->weights[LIST_OP_FIND] = 95;
+        config->weights[LIST_OP_INSERT] = 5;
+    } else if (strcmp(name, "churn") == 0) {
+        config->weights[LIST_OP_INSERT] = 50;
+        config->weights[LIST_OP_REMOVE] = 50;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Sets the weight of operations from a comma separated list of
+// operation=weight.
+bool workload_parse_mix(WorkloadConfig *config, const char *mix) {
+    char *copy = strdup(mix);
+    bool parsed = true;
+    memset(config->weights, 0, sizeof(config->weights));
+    for (char *item = strtok(copy, ","); item != NULL && parsed; item = strtok(NULL, ",")) {
+        char *equals = strchr(item, '=');
+        parsed = false;
+        if (equals != NULL) {
+            *equals = '\0';
+            for (int op = 0; op < LIST_OP_COUNT; op++) {
+                if (runnable(op) && strcmp(item, list_operation_name(op)) == 0) {
+                    config->weights[op] = atof(equals + 1);
+                    parsed = config->weights[op] >= 0;
+                }
+            }
+        }
+    }
+    free(copy);
+    return parsed;
+}
+
+// Returns the element numbered key.
+static Element element_of(int key) {
+    Element element;
+    element.value = key;
+    snprintf(element.id, sizeof(element.id), "%07u", (unsigned)key % 10000000u);
+    return element;
+}
+
+static bool equal_values(Element *a, Element *b) {
+    return a->value == b->value;
+}
+
+static bool same_key(const Element *a, const Element *b) {
+    return a->value == b->value;
+}
+
+// Inserts size elements at the end of the list.
+void workload_load(ListMM list, size_t size) {
+    int first = (int)list_size(list);
+    for (size_t i = 0; i < size; i++) {
+        Element element = element_of(first + (int)i);
+        list_insert_last(list, &element);
+    }
+}
+
+static uint64_t next_random(_Workload *workload) {
+    workload->random ^= workload->random << 13;
+    workload->random ^= workload->random >> 7;
+    workload->random ^= workload->random << 17;
+    return workload->random;
+}
+
+// Returns a pseudo-random number in [0, 1).
+static double next_double(_Workload *workload) {
+    return (next_random(workload) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Extends the zipfian generator to at least items items.
+static void zipfian_grow(_Zipfian *zipfian, size_t items) {
+    if (items <= zipfian->items) {
+        return;
+    }
+    for (size_t i = zipfian->items + 1; i <= items; i++) {
+        zipfian->zetan += 1 / pow((double)i, zipfian->theta);
+    }
+    zipfian->items = items;
+    zipfian->eta = (1 - pow(2.0 / items, 1 - zipfian->theta)) / (1 - zipfian->zeta2 / zipfian->zetan);
+}
+
+// Returns a zipfian rank below items, where 0 is the most likely.
+static size_t next_zipfian(_Workload *workload, size_t items) {
+    _Zipfian *zipfian = &workload->zipfian;
+    zipfian_grow(zipfian, items);
+    double u = next_double(workload);
+    double uz = u * zipfian->zetan;
+    size_t rank;
+    if (uz < 1) {
+        rank = 0;
+    } else if (uz < 1 + pow(0.5, zipfian->theta)) {
+        rank = 1;
+    } else {
+        rank = (size_t)(zipfian->items * pow(zipfian->eta * u - zipfian->eta + 1, zipfian->alpha));
+    }
+    // The generator may cover more items than remain.
+    return rank % items;
+}
+
+// Returns a number below bound, following the configured distribution.
+static size_t next_position(_Workload *workload, size_t bound) {
+    switch (workload->config->distribution) {
+    case WORKLOAD_ZIPFIAN:
+        return next_zipfian(workload, bound);
+    case WORKLOAD_LATEST:
+        return bound - 1 - next_zipfian(workload, bound);
+    default:
+        return (size_t)(next_random(workload) % bound);
+    }
+}
+
+// Returns an operation drawn according to the weights.
+static ListOperation next_operation(_Workload *workload) {
+    double draw = next_double(workload) * workload->total_weight;
+    ListOperation last = LIST_OP_INSERT_LAST;
+    for (int op = 0; op < LIST_OP_COUNT; op++) {
+        if (runnable(op) && workload->config->weights[op] > 0) {
+            last = op;
+            if (draw < workload->config->weights[op]) {
+                break;
+            }
+            draw -= workload->config->weights[op];
+        }
+    }
+    return last;
+}
+
+// Runs an operation on the list. Operations that need an element are
+// replaced by insert_last while the list is empty. The size is tracked here,
+// so that only the size operations of the mix call list_size.
+static void run_operation(_Workload *workload, ListMM list, ListOperation operation) {
+    size_t size = workload->size;
+    Element element;
+    if (size == 0 && operation != LIST_OP_INSERT_FIRST && operation != LIST_OP_INSERT &&
+        operation != LIST_OP_IS_EMPTY && operation != LIST_OP_SIZE) {
+        operation = LIST_OP_INSERT_LAST;
+    }
+    switch (operation) {
+    case LIST_OP_IS_EMPTY:
+        list_is_empty(list);
+        break;
+    case LIST_OP_SIZE:
+        list_size(list);
+        break;
+    case LIST_OP_INSERT_FIRST:
+        element = element_of(workload->next_key++);
+        list_insert_first(list, &element);
+        workload->size++;
+        break;
+    case LIST_OP_INSERT_LAST:
+        element = element_of(workload->next_key++);
+        list_insert_last(list, &element);
+        workload->size++;
+        break;
+    case LIST_OP_INSERT:
+        element = element_of(workload->next_key++);
+        list_insert(list, &element, next_position(workload, size + 1));
+        workload->size++;
+        break;
+    case LIST_OP_FIND:
+        element = element_of((int)next_position(workload, (size_t)workload->next_key));
+        list_find(list, equal_values, &element);
+        break;
+    case LIST_OP_GET_FIRST:
+        list_get_first(list);
+        break;
+    case LIST_OP_GET_LAST:
+        list_get_last(list);
+        break;
+    case LIST_OP_GET:
+        list_get(list, next_position(workload, size));
+        break;
+    case LIST_OP_REMOVE_FIRST:
+        list_remove_first(list);
+        workload->size--;
+        break;
+    case LIST_OP_REMOVE_LAST:
+        list_remove_last(list);
+        workload->size--;
+        break;
+    case LIST_OP_REMOVE:
+        list_remove(list, next_position(workload, size));
+        workload->size--;
+        break;
+    case LIST_OP_SET:
+        element = element_of(workload->next_key++);
+        list_set(list, next_position(workload, size), &element);
+        break;
+    case LIST_OP_UPSERT:
+        // Either an existing key or the next one.
+        element = element_of((int)next_position(workload, (size_t)workload->next_key + 1));
+        if (element.value == workload->next_key) {
+            workload->next_key++;
+        }
+        if (!list_upsert(list, same_key, &element)) {
+            workload->size++;
+        }
+        break;
+    case LIST_OP_FIND_BY_ID:
+        element = element_of((int)next_position(workload, (size_t)workload->next_key));
+        list_find_by_id(list, element.id, &element);
+        break;
+    default:
+        break;
+    }
+}
+
+// Runs the workload configured by config against the list.
+WorkloadResult run_workload(ListMM list, const WorkloadConfig *config) {
+    _Workload workload;
+    WorkloadResult result = {0, 0};
+    workload.config = config;
+    workload.random = config->seed == 0 ? 1 : config->seed;
+    workload.total_weight = 0;
+    for (int op = 0; op < LIST_OP_COUNT; op++) {
+        if (runnable(op) && config->weights[op] > 0) {
+            workload.total_weight += config->weights[op];
+        }
+    }
+    workload.size = list_size(list);
+    workload.next_key = (int)workload.size;
+    workload.zipfian.theta = config->zipfian_theta;
+    workload.zipfian.alpha = 1 / (1 - config->zipfian_theta);
+    workload.zipfian.zeta2 = 1 + 1 / pow(2, config->zipfian_theta);
+    workload.zipfian.zetan = 0;
+    workload.zipfian.items = 0;
+    zipfian_grow(&workload.zipfian, 2);
+    if (workload.total_weight <= 0 || (config->operations == 0 && config->duration_s <= 0)) {
+        return result;
+    }
+    list_enable_latency(list);
+
+    uint64_t start = latency_now_ns();
+    uint64_t deadline = config->duration_s > 0 ? start + (uint64_t)(config->duration_s * 1e9) : UINT64_MAX;
+    while (config->operations == 0 || result.operations < config->operations) {
+        run_operation(&workload, list, next_operation(&workload));
+        result.operations++;
+        // Reading the clock on every operation would add to short operations.
+        if (result.operations % 64 == 0 && latency_now_ns() >= deadline) {
+            break;
+        }
+    }
+    result.elapsed_ns = latency_now_ns() - start;
+    return result;
+}
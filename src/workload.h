@@ -0,0 +1,62 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list_mm.h"
+
+// How the positions and elements used by operations are chosen.
+typedef enum {
+    // Every position is equally likely.
+    WORKLOAD_UNIFORM,
+    // Positions near the head are the most likely, following a zipfian
+    // distribution.
+    WORKLOAD_ZIPFIAN,
+    // Like WORKLOAD_ZIPFIAN, but for positions near the tail and the most
+    // recently inserted elements.
+    WORKLOAD_LATEST
+} WorkloadDistribution;
+
+// A mix of operations run against a list.
+typedef struct {
+    // Relative weight of each operation in the mix. Only the operations that
+    // take no more than a position or an element are run.
+    double weights[LIST_OP_COUNT];
+    WorkloadDistribution distribution;
+    // Skew of the zipfian distributions, between 0 and 1.
+    double zipfian_theta;
+    // The run stops after this many operations or seconds, whichever comes
+    // first. Zero means no limit, but one of them must be set.
+    uint64_t operations;
+    double duration_s;
+    uint64_t seed;
+} WorkloadConfig;
+
+// Outcome of a run. Latencies are recorded by the list, see list_latency.
+typedef struct {
+    uint64_t operations;
+    uint64_t elapsed_ns;
+} WorkloadResult;
+
+// Sets the weights of config to a mix named name: "read-mostly" (95% get, 5% insert),
+// "read-insert" (50% get, 50% insert), "queue" (50% insert_last, 50%
+// remove_first), "scan" (95% find, 5% insert) or "churn" (50% insert, 50%
+// remove). Returns false if there is no such mix.
+bool workload_preset(WorkloadConfig *config, const char *name);
+
+// Sets the weights of config from a comma separated list of
+// operation=weight, using the names of list_operation_name. Returns false if
+// an operation is unknown or cannot be run.
+bool workload_parse_mix(WorkloadConfig *config, const char *mix);
+
+// Inserts size elements at the end of the list, numbering them from the
+// current size, as a workload would.
+void workload_load(ListMM list, size_t size);
+
+// Runs the workload configured by config against the list, whose latencies
+// are recorded by enabling list_enable_latency if it is not yet enabled.
+WorkloadResult run_workload(ListMM list, const WorkloadConfig *config);
+
+#endif
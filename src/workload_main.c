@@ -0,0 +1,107 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "workload.h"
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s --file NAME [--backend NAME] [--load N] [--preset NAME | --mix OP=WEIGHT,...] "
+            "[--distribution uniform|zipfian|latest] [--theta X] [--ops N] [--duration SECONDS] [--cache N] "
+            "[--seed N] [--trace FILE]\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    WorkloadConfig config;
+    const char *file_name = NULL;
+    const char *trace_file_name = NULL;
+    FileMemOptions options = {.mode = FILE_MEM_PRIVATE, .backend = NULL};
+    size_t load = 0, cache = 0;
+    workload_preset(&config, "read-mostly");
+    config.distribution = WORKLOAD_UNIFORM;
+    config.zipfian_theta = 0.99;
+    config.operations = 0;
+    config.duration_s = 0;
+    config.seed = 42;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char *option = argv[i], *argument = argv[i + 1];
+        if (strcmp(option, "--file") == 0) {
+            file_name = argument;
+        } else if (strcmp(option, "--backend") == 0) {
+            options.backend = find_storage_backend(argument);
+            if (options.backend == NULL) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(option, "--load") == 0) {
+            load = (size_t)strtod(argument, NULL);
+        } else if (strcmp(option, "--preset") == 0) {
+            if (!workload_preset(&config, argument)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(option, "--mix") == 0) {
+            if (!workload_parse_mix(&config, argument)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(option, "--distribution") == 0) {
+            config.distribution = strcmp(argument, "zipfian") == 0  ? WORKLOAD_ZIPFIAN
+                                  : strcmp(argument, "latest") == 0 ? WORKLOAD_LATEST
+                                                                    : WORKLOAD_UNIFORM;
+        } else if (strcmp(option, "--theta") == 0) {
+            config.zipfian_theta = atof(argument);
+        } else if (strcmp(option, "--ops") == 0) {
+            config.operations = (uint64_t)strtod(argument, NULL);
+        } else if (strcmp(option, "--duration") == 0) {
+            config.duration_s = atof(argument);
+        } else if (strcmp(option, "--cache") == 0) {
+            cache = (size_t)strtod(argument, NULL);
+        } else if (strcmp(option, "--trace") == 0) {
+            trace_file_name = argument;
+        } else if (strcmp(option, "--seed") == 0) {
+            config.seed = strtoull(argument, NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (file_name == NULL || (config.operations == 0 && config.duration_s <= 0) || config.zipfian_theta <= 0 ||
+        config.zipfian_theta >= 1) {
+        usage(argv[0]);
+    }
+
+    // An existing list is used as is; otherwise it is created and loaded.
+    ListMM list = list_open_with_options(file_name, &options);
+    if (list == NULL) {
+        list = list_create_with_options(file_name, &options);
+        if (list == NULL) {
+            fprintf(stderr, "Could not open or create %s.\n", file_name);
+            return 1;
+        }
+        if (cache > 0) {
+            list_enable_cache(list, cache);
+        }
+        workload_load(list, load);
+    } else if (cache > 0) {
+        list_enable_cache(list, cache);
+    }
+
+    if (trace_file_name != NULL && !list_start_trace(list, trace_file_name)) {
+        fprintf(stderr, "Could not create %s.\n", trace_file_name);
+        return 1;
+    }
+    WorkloadResult result = run_workload(list, &config);
+    list_stop_trace(list);
+    double seconds = result.elapsed_ns / 1e9;
+    printf("operations=%" PRIu64 " seconds=%.3f throughput=%.0f ops/s\n", result.operations, seconds,
+           seconds > 0 ? result.operations / seconds : 0);
+    LatencyHistogram all = latency_histogram_create();
+    for (int op = 0; op < LIST_OP_COUNT; op++) {
+        latency_histogram_add(all, list_latency(list, op));
+    }
+    latency_histogram_print(all, stdout, "all");
+    latency_histogram_destroy(all);
+    list_print_latency(list, stdout);
+    list_close(list);
+    return 0;
+}